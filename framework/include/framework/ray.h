@@ -10,4 +10,5 @@ struct Ray {
     glm::vec3 origin { 0.0f };
     glm::vec3 direction { 0.0f, 0.0f, -1.0f };
     float t { std::numeric_limits<float>::max() };
+    float time { 0.0f }; // Moment within the shutter interval, in [0, 1]; only used for motion blur.
 };
@@ -0,0 +1,118 @@
+#include "animation.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <iostream>
+
+// Find the keyframes surrounding frame and the interpolation weight between them. Keyframes are expected in
+// increasing order of their frame.
+template <typename Keyframe>
+static void findKeyframes(std::span<const Keyframe> keyframes, float frame, size_t& first, size_t& second, float& alpha)
+{
+    const auto upper = std::upper_bound(std::begin(keyframes), std::end(keyframes), frame,
+        [](float value, const Keyframe& keyframe) { return value < keyframe.frame; });
+    const auto upperIdx = size_t(std::distance(std::begin(keyframes), upper));
+    first = upperIdx == 0 ? 0 : upperIdx - 1;
+    second = std::min(upperIdx, keyframes.size() - 1);
+    const float span = keyframes[second].frame - keyframes[first].frame;
+    alpha = span > 0.0f ? glm::clamp((frame - keyframes[first].frame) / span, 0.0f, 1.0f) : 0.0f;
+}
+
+CameraConfig interpolateCamera(std::span<const CameraKeyframe> keyframes, float frame)
+{
+    if (keyframes.empty())
+        return CameraConfig {};
+
+    size_t first, second;
+    float alpha;
+    findKeyframes(keyframes, frame, first, second, alpha);
+    const CameraConfig& a = keyframes[first].camera;
+    const CameraConfig& b = keyframes[second].camera;
+    return CameraConfig {
+        glm::mix(a.fieldOfView, b.fieldOfView, alpha),
+        glm::mix(a.distanceFromLookAt, b.distanceFromLookAt, alpha),
+        glm::mix(a.lookAt, b.lookAt, alpha),
+        glm::mix(a.rotation, b.rotation, alpha)
+    };
+}
+
+glm::mat4 interpolateTransform(std::span<const TransformKeyframe> keyframes, float frame)
+{
+    if (keyframes.empty())
+        return glm::mat4(1.0f);
+
+    size_t first, second;
+    float alpha;
+    findKeyframes(keyframes, frame, first, second, alpha);
+    const TransformKeyframe& a = keyframes[first];
+    const TransformKeyframe& b = keyframes[second];
+    return composeTransform(glm::mix(a.translation, b.translation, alpha), glm::mix(a.rotation, b.rotation, alpha), glm::mix(a.scale, b.scale, alpha));
+}
+
+glm::mat4 composeTransform(const glm::vec3& translation, const glm::vec3& rotation, const glm::vec3& scale)
+{
+    const glm::vec3 radians = glm::radians(rotation);
+    glm::mat4 transform = glm::translate(glm::mat4(1.0f), translation);
+    transform = glm::rotate(transform, radians.z, glm::vec3(0, 0, 1));
+    transform = glm::rotate(transform, radians.y, glm::vec3(0, 1, 0));
+    transform = glm::rotate(transform, radians.x, glm::vec3(1, 0, 0));
+    return glm::scale(transform, scale);
+}
+
+void placeInstances(Scene& scene, std::span<const InstanceConfig> instances)
+{
+    std::vector<bool> placed(scene.meshes.size(), false);
+    for (const auto& instanceConfig : instances) {
+        if (instanceConfig.meshIdx >= scene.meshes.size()) {
+            std::cerr << "Instance of mesh " << instanceConfig.meshIdx << " does not exist -- Skip" << std::endl;
+            continue;
+        }
+        const MeshInstance instance { instanceConfig.meshIdx, composeTransform(instanceConfig.translation, instanceConfig.rotation, instanceConfig.scale) };
+        if (!placed[instanceConfig.meshIdx]) {
+            placed[instanceConfig.meshIdx] = true;
+            const auto loaded = std::find_if(std::begin(scene.instances), std::end(scene.instances),
+                [&](const MeshInstance& other) { return other.meshIdx == instanceConfig.meshIdx; });
+            if (loaded != std::end(scene.instances)) {
+                *loaded = instance;
+                continue;
+            }
+        }
+        scene.instances.push_back(instance);
+    }
+}
+
+SceneAnimator::SceneAnimator(const Scene& scene, const AnimationConfig& animation)
+{
+    for (const auto& instanceAnimation : animation.instances) {
+        if (instanceAnimation.instanceIdx >= scene.instances.size()) {
+            std::cerr << "Warning: Animated instance " << instanceAnimation.instanceIdx << " does not exist -- Skip" << std::endl;
+            continue;
+        }
+        m_instances.push_back(AnimatedInstance {
+            instanceAnimation.instanceIdx,
+            instanceAnimation.keyframes,
+            scene.instances[instanceAnimation.instanceIdx].transform });
+    }
+}
+
+bool SceneAnimator::setFrame(Scene& scene, float frame, float shutter)
+{
+    bool changed = false;
+    for (const AnimatedInstance& animatedInstance : m_instances) {
+        MeshInstance& instance = scene.instances[animatedInstance.instanceIdx];
+        const glm::mat4 transform = interpolateTransform(animatedInstance.keyframes, frame) * animatedInstance.restTransform;
+        std::optional<glm::mat4> motionTransform;
+        if (shutter > 0.0f)
+            motionTransform = interpolateTransform(animatedInstance.keyframes, frame + shutter) * animatedInstance.restTransform;
+        if (transform != instance.transform || motionTransform != instance.motionTransform) {
+            instance.transform = transform;
+            instance.motionTransform = motionTransform;
+            changed = true;
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "config.h"
+#include "scene.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+DISABLE_WARNINGS_POP()
+#include <span>
+#include <vector>
+
+// Keyframes must be sorted by frame (readConfigFile does so).
+
+// Camera at the given frame, interpolated linearly between the surrounding keyframes (and clamped outside of them).
+CameraConfig interpolateCamera(std::span<const CameraKeyframe> keyframes, float frame);
+
+// Object-to-world transform at the given frame, interpolated linearly between the surrounding keyframes.
+glm::mat4 interpolateTransform(std::span<const TransformKeyframe> keyframes, float frame);
+
+// Object-to-world transform that scales, then rotates (in degrees, about x, then y, then z) and then translates.
+glm::mat4 composeTransform(const glm::vec3& translation, const glm::vec3& rotation, const glm::vec3& scale);
+
+// Place the configured instances in a scene as loaded. A mesh with configured instances is only rendered at those:
+// the first one replaces the identity instance that the loader gave the mesh (so instance i stays the first
+// placement of mesh i), the others are appended.
+void placeInstances(Scene& scene, std::span<const InstanceConfig> instances);
+
+// Moves the animated instances of a scene that stays loaded for the whole animation. The keyframed transform is
+// applied on top of the transform that an instance was loaded with; the meshes themselves are never touched.
+class SceneAnimator {
+public:
+    SceneAnimator(const Scene& scene, const AnimationConfig& animation);
+
+    // Move the animated instances to their transform at the given frame. With a shutter interval (in frames) larger
+    // than zero, they also get their transform at the time the shutter closes, for motion blur. Returns true if any
+    // of them moved, in which case the BVH must be updated (which only touches its top level).
+    bool setFrame(Scene& scene, float frame, float shutter = 0.0f);
+
+private:
+    struct AnimatedInstance {
+        uint32_t instanceIdx;
+        std::vector<TransformKeyframe> keyframes;
+        glm::mat4 restTransform;
+    };
+    std::vector<AnimatedInstance> m_instances;
+};
@@ -0,0 +1,274 @@
+#include "bounding_volume_hierarchy.h"
+#include "bvh_interface.h"
+#include "config.h"
+#include "draw.h"
+#include "render.h"
+#include "scene.h"
+#include "screen.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <framework/trackball.h>
+#include <framework/window.h>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Renders every prebuilt scene headless with a fixed camera and a fixed set of feature combinations, and reports
+// the timings as JSON so that they can be compared between commits:
+//
+//   FinalProjectBenchmark [--repetitions N] [--resolution WxH] [--output results.json]
+//
+// Every configuration is rendered once to warm up and then N times; render times are reported as the median and
+// 95th percentile over those N runs. Throughput is measured separately by tracing only the camera rays (closest
+// hit, no shading), so that it reflects the acceleration structure rather than the shading code.
+//
+// Finally the meshes are deformed and the BVH is refit, which is timed against building it again. The refit BVH
+// has to find the same camera ray hits as the rebuilt one; the benchmark fails if it does not.
+
+using clock_type = std::chrono::high_resolution_clock;
+
+struct BenchmarkFeatureSet {
+    const char* name;
+    Features features;
+};
+
+static std::vector<BenchmarkFeatureSet> benchmarkFeatureSets()
+{
+    Features primary {};
+    primary.enableShading = true;
+    primary.enableAccelStructure = true;
+
+    Features shadows = primary;
+    shadows.enableHardShadow = true;
+    shadows.enableRecursive = true;
+    shadows.enableNormalInterp = true;
+
+    Features full = shadows;
+    full.enableSoftShadow = true;
+    full.enableTextureMapping = true;
+    full.enableLightSampling = true;
+
+    return { { "primary", primary }, { "shadows", shadows }, { "full", full } };
+}
+
+struct TimingSummary {
+    double median, p95, min;
+};
+
+static TimingSummary summarize(std::vector<double> timesMs)
+{
+    std::sort(std::begin(timesMs), std::end(timesMs));
+    const auto percentile = [&](double p) {
+        const size_t idx = std::min(size_t(p * double(timesMs.size() - 1) + 0.5), timesMs.size() - 1);
+        return timesMs[idx];
+    };
+    return TimingSummary { percentile(0.5), percentile(0.95), timesMs.front() };
+}
+
+static double millisecondsSince(clock_type::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+// Trace the camera ray of every pixel without shading it; returns the time in milliseconds.
+static double traceCameraRays(const Trackball& camera, const BvhInterface& bvh, const glm::ivec2& resolution, const Features& features)
+{
+    const auto start = clock_type::now();
+#ifdef NDEBUG
+#pragma omp parallel for schedule(guided)
+#endif
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x != resolution.x; x++) {
+            const glm::vec2 normalizedPixelPos {
+                float(x) / float(resolution.x) * 2.0f - 1.0f,
+                float(y) / float(resolution.y) * 2.0f - 1.0f
+            };
+            Ray ray = camera.generateRay(normalizedPixelPos);
+            HitInfo hitInfo;
+            bvh.intersect(ray, hitInfo, features);
+        }
+    }
+    return millisecondsSince(start);
+}
+
+// Move every vertex along its normal by up to 1% of the size of its mesh, in a fixed pseudo-random pattern.
+static void deformMeshes(Scene& scene)
+{
+    for (Mesh& mesh : scene.meshes) {
+        if (mesh.vertices.empty())
+            continue;
+        glm::vec3 lower = mesh.vertices[0].position, upper = lower;
+        for (const Vertex& vertex : mesh.vertices) {
+            lower = glm::min(lower, vertex.position);
+            upper = glm::max(upper, vertex.position);
+        }
+        const float amplitude = 0.01f * glm::length(upper - lower);
+        if (amplitude <= 0.0f)
+            continue;
+        for (Vertex& vertex : mesh.vertices)
+            vertex.position += amplitude * std::sin(glm::dot(vertex.position, glm::vec3(12.9898f, 78.233f, 37.719f)) / amplitude) * vertex.normal;
+    }
+}
+
+// Trace the camera ray of every pixel through both hierarchies; returns the number of rays for which they disagree.
+static size_t countHitMismatches(const Trackball& camera, const BvhInterface& bvh, const BvhInterface& referenceBvh, const glm::ivec2& resolution, const Features& features)
+{
+    size_t numMismatches = 0;
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x != resolution.x; x++) {
+            const glm::vec2 normalizedPixelPos {
+                float(x) / float(resolution.x) * 2.0f - 1.0f,
+                float(y) / float(resolution.y) * 2.0f - 1.0f
+            };
+            Ray ray = camera.generateRay(normalizedPixelPos), referenceRay = ray;
+            HitInfo hitInfo, referenceHitInfo;
+            const bool hit = bvh.intersect(ray, hitInfo, features);
+            const bool referenceHit = referenceBvh.intersect(referenceRay, referenceHitInfo, features);
+            if (hit != referenceHit || ray.t != referenceRay.t)
+                numMismatches++;
+        }
+    }
+    return numMismatches;
+}
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--repetitions N] [--resolution WxH] [--output results.json]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    int repetitions = 5;
+    glm::ivec2 resolution { 400, 400 };
+    std::optional<std::filesystem::path> outputPath;
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--repetitions") == 0 && hasValue) {
+            repetitions = std::max(std::atoi(argv[++i]), 1);
+        } else if (std::strcmp(argv[i], "--resolution") == 0 && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &resolution.x, &resolution.y) != 2 || resolution.x <= 0 || resolution.y <= 0) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--output") == 0 && hasValue) {
+            outputPath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Trackball needs a window; like the command-line renderer, create one that is never shown.
+    enableDebugDraw = false;
+    Window window { "Final Project Benchmark", resolution, OpenGLVersion::GL2, false };
+    const CameraConfig cameraConfig {};
+    Trackball camera { &window, glm::radians(cameraConfig.fieldOfView), cameraConfig.distanceFromLookAt };
+    camera.setCamera(cameraConfig.lookAt, glm::radians(cameraConfig.rotation), cameraConfig.distanceFromLookAt);
+
+    const std::vector<BenchmarkFeatureSet> featureSets = benchmarkFeatureSets();
+    const double numCameraRays = double(resolution.x) * double(resolution.y);
+
+    std::string results;
+    bool refitMismatch = false;
+    for (int sceneTypeIdx = SceneType::SingleTriangle; sceneTypeIdx <= SceneType::Custom; sceneTypeIdx++) {
+        const auto sceneType = SceneType(sceneTypeIdx);
+        const std::string sceneName = serialize(sceneType);
+        if (!results.empty())
+            results += ",\n";
+
+        Scene scene;
+        try {
+            scene = loadScenePrebuilt(sceneType, Config {}.dataPath);
+        } catch (const std::exception&) {
+            std::cerr << "Skipping scene " << sceneName << ": it could not be loaded." << std::endl;
+            results += fmt::format("    {{ \"scene\": \"{}\", \"skipped\": true }}", sceneName);
+            continue;
+        }
+
+        const auto buildStart = clock_type::now();
+        BvhInterface bvh { &scene };
+        const double buildMs = millisecondsSince(buildStart);
+
+        std::string configurations;
+        for (const auto& [featureSetName, features] : featureSets) {
+            std::cerr << "Benchmarking " << sceneName << " (" << featureSetName << ")" << std::endl;
+            Screen screen { resolution, false };
+            std::vector<double> renderTimes, traceTimes;
+            for (int repetition = -1; repetition < repetitions; repetition++) {
+                screen.clear(glm::vec3(0.0f));
+                const auto renderStart = clock_type::now();
+                renderRayTracing(scene, camera, bvh, screen, features);
+                const double renderMs = millisecondsSince(renderStart);
+                const double traceMs = traceCameraRays(camera, bvh, resolution, features);
+                // The first run only warms up the caches.
+                if (repetition >= 0) {
+                    renderTimes.push_back(renderMs);
+                    traceTimes.push_back(traceMs);
+                }
+            }
+
+            const TimingSummary render = summarize(renderTimes);
+            const TimingSummary trace = summarize(traceTimes);
+            if (!configurations.empty())
+                configurations += ",\n";
+            configurations += fmt::format(
+                "        {{ \"features\": \"{}\", \"render_ms\": {{ \"median\": {:.3f}, \"p95\": {:.3f}, \"min\": {:.3f} }}, "
+                "\"trace_ms\": {{ \"median\": {:.3f}, \"p95\": {:.3f}, \"min\": {:.3f} }}, \"mrays_per_s\": {:.3f} }}",
+                featureSetName, render.median, render.p95, render.min, trace.median, trace.p95, trace.min, numCameraRays / (trace.median * 1e3));
+        }
+
+        size_t numTriangles = 0;
+        for (const auto& instance : scene.instances)
+            numTriangles += scene.meshes[instance.meshIdx].triangles.size();
+        const int numLevels = bvh.numLevels(), numLeaves = bvh.numLeaves();
+
+        // Bring the BVH up to date with deformed meshes by refitting it, and by building it again for comparison.
+        deformMeshes(scene);
+        const auto refitStart = clock_type::now();
+        BoundingVolumeHierarchy::ofScene(scene)->refit();
+        const double refitMs = millisecondsSince(refitStart);
+        const auto rebuildStart = clock_type::now();
+        const BvhInterface rebuiltBvh { &scene };
+        const double rebuildMs = millisecondsSince(rebuildStart);
+        const size_t refitMismatches = countHitMismatches(camera, bvh, rebuiltBvh, resolution, featureSets.front().features);
+        if (refitMismatches > 0) {
+            std::cerr << "The refit BVH of " << sceneName << " disagrees with a rebuilt one on " << refitMismatches << " rays." << std::endl;
+            refitMismatch = true;
+        }
+
+        results += fmt::format(
+            "    {{ \"scene\": \"{}\", \"triangles\": {}, \"spheres\": {}, \"bvh_build_ms\": {:.3f}, \"bvh_levels\": {}, \"bvh_leaves\": {},\n"
+            "      \"bvh_refit_ms\": {:.3f}, \"bvh_rebuild_ms\": {:.3f}, \"bvh_refit_mismatches\": {},\n"
+            "      \"configurations\": [\n{}\n      ] }}",
+            sceneName, numTriangles, scene.spheres.size(), buildMs, numLevels, numLeaves, refitMs, rebuildMs, refitMismatches, configurations);
+    }
+
+    const std::string json = fmt::format(
+        "{{\n  \"timestamp\": \"{:%Y-%m-%dT%H:%M:%S}\",\n  \"resolution\": [{}, {}],\n  \"repetitions\": {},\n  \"threads\": {},\n"
+        "  \"scenes\": [\n{}\n  ]\n}}\n",
+        fmt::localtime(std::time(nullptr)), resolution.x, resolution.y, repetitions, std::thread::hardware_concurrency(), results);
+    if (outputPath) {
+        std::ofstream { *outputPath } << json;
+        std::cerr << "Results written to " << *outputPath << std::endl;
+    } else {
+        std::cout << json;
+    }
+    return refitMismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -4,27 +4,604 @@
 #include "scene.h"
 #include "texture.h"
 #include "interpolate.h"
+#include "ray_recorder.h"
+#include "ray_statistics.h"
+#include "trace_events.h"
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <span>
+#include <unordered_map>
 
+// Number of bins that the centroids are sorted into along each axis when searching for the best split.
+static constexpr size_t numSahBins = 16;
+// Cost of traversing a node relative to intersecting a primitive.
+static constexpr float sahTraversalCost = 1.0f;
+// Leaves are only made larger than this if splitting them does not separate any primitives.
+static constexpr uint32_t maxLeafSize = 4;
+// Spheres are intersected a batch at a time, so the leaves of the top-level tree hold up to a full batch and every
+// primitive in them is counted as cheaper by the SAH.
+static constexpr uint32_t maxTopLevelLeafSize = sphereBatchWidth;
+static constexpr float topLevelPrimitiveCost = float(maxLeafSize) / float(maxTopLevelLeafSize);
+// A refit tree is rebuilt once its SAH cost exceeds its cost after the build by this factor.
+static constexpr float sahRebuildThreshold = 1.5f;
+// Levels with fewer nodes than this are refit on a single thread.
+static constexpr int minParallelRefitNodes = 4096;
+// Deeper nodes are turned into leaves, which bounds the traversal stack.
+static constexpr int maxTreeDepth = 48;
+static constexpr size_t traversalStackSize = maxTreeDepth + 2;
+
+static AxisAlignedBox emptyBox()
+{
+    return AxisAlignedBox { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+}
+
+static void growBox(AxisAlignedBox& box, const AxisAlignedBox& other)
+{
+    box.lower = glm::min(box.lower, other.lower);
+    box.upper = glm::max(box.upper, other.upper);
+}
+
+static float surfaceArea(const AxisAlignedBox& box)
+{
+    const glm::vec3 extent = glm::max(box.upper - box.lower, 0.0f);
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+// World space box around a box in object space.
+static AxisAlignedBox transformBox(const AxisAlignedBox& box, const glm::mat4& transform)
+{
+    AxisAlignedBox result = emptyBox();
+    for (int corner = 0; corner < 8; corner++) {
+        const glm::vec3 position { (corner & 1) ? box.upper.x : box.lower.x, (corner & 2) ? box.upper.y : box.lower.y, (corner & 4) ? box.upper.z : box.lower.z };
+        const glm::vec3 transformed = glm::vec3(transform * glm::vec4(position, 1.0f));
+        result.lower = glm::min(result.lower, transformed);
+        result.upper = glm::max(result.upper, transformed);
+    }
+    return result;
+}
+
+static AxisAlignedBox sphereBounds(const Sphere& sphere)
+{
+    return AxisAlignedBox { sphere.center - glm::vec3(sphere.radius), sphere.center + glm::vec3(sphere.radius) };
+}
+
+static AxisAlignedBox triangleBounds(const Mesh& mesh, uint32_t triangleIdx)
+{
+    const glm::uvec3& tri = mesh.triangles[triangleIdx];
+    const glm::vec3 &v0 = mesh.vertices[tri[0]].position, &v1 = mesh.vertices[tri[1]].position, &v2 = mesh.vertices[tri[2]].position;
+    return AxisAlignedBox { glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)) };
+}
+
+// Expected cost of tracing a ray through the tree, relative to the area of the root.
+static float computeSahCost(const BvhTree& tree)
+{
+    if (tree.nodes.empty())
+        return 0.0f;
+    float cost = 0.0f;
+    for (const BvhNode& node : tree.nodes)
+        cost += surfaceArea(node.bounds) * (node.isLeaf() ? float(node.numPrimitives) : sahTraversalCost);
+    return cost / std::max(surfaceArea(tree.nodes[0].bounds), std::numeric_limits<float>::min());
+}
+
+// Build a tree over the given primitives; primitiveBounds is indexed by the values in primitiveIds.
+// primitiveCost is the cost of intersecting a primitive relative to traversing a node.
+static BvhTree buildTree(std::vector<uint32_t> primitiveIds, std::span<const AxisAlignedBox> primitiveBounds, uint32_t leafSize = maxLeafSize, float primitiveCost = 1.0f)
+{
+    BvhTree tree;
+    if (primitiveIds.empty())
+        return tree;
+
+    std::vector<glm::vec3> centroids(primitiveBounds.size());
+    for (uint32_t id : primitiveIds)
+        centroids[id] = 0.5f * (primitiveBounds[id].lower + primitiveBounds[id].upper);
+
+    struct WorkItem {
+        uint32_t nodeIdx, begin, end;
+        int depth;
+    };
+    std::vector<WorkItem> work { WorkItem { 0, 0, uint32_t(primitiveIds.size()), 1 } };
+    std::vector<int> nodeDepths;
+    tree.nodes.emplace_back();
+    while (!work.empty()) {
+        const WorkItem item = work.back();
+        work.pop_back();
+        nodeDepths.resize(tree.nodes.size());
+        nodeDepths[item.nodeIdx] = item.depth;
+        const uint32_t numPrimitives = item.end - item.begin;
+        tree.numLevels = std::max(tree.numLevels, item.depth);
+
+        AxisAlignedBox bounds = emptyBox(), centroidBounds = emptyBox();
+        for (uint32_t i = item.begin; i < item.end; i++) {
+            growBox(bounds, primitiveBounds[primitiveIds[i]]);
+            growBox(centroidBounds, AxisAlignedBox { centroids[primitiveIds[i]], centroids[primitiveIds[i]] });
+        }
+        tree.nodes[item.nodeIdx].bounds = bounds;
+
+        // Find the cheapest split between the bins along any axis.
+        int bestAxis = -1;
+        size_t bestSplit = 0;
+        float bestCost = std::numeric_limits<float>::max();
+        const glm::vec3 centroidExtent = centroidBounds.upper - centroidBounds.lower;
+        for (int axis = 0; axis < 3 && numPrimitives > 1; axis++) {
+            if (centroidExtent[axis] <= 0.0f)
+                continue;
+            std::array<AxisAlignedBox, numSahBins> binBounds;
+            std::array<uint32_t, numSahBins> binCounts {};
+            binBounds.fill(emptyBox());
+            const float binScale = float(numSahBins) / centroidExtent[axis];
+            for (uint32_t i = item.begin; i < item.end; i++) {
+                const size_t bin = std::min(size_t((centroids[primitiveIds[i]][axis] - centroidBounds.lower[axis]) * binScale), numSahBins - 1);
+                growBox(binBounds[bin], primitiveBounds[primitiveIds[i]]);
+                binCounts[bin]++;
+            }
+
+            // Sweep from the right to get the cost of everything to the right of each split, then from the left.
+            std::array<float, numSahBins> rightCosts {};
+            AxisAlignedBox rightBounds = emptyBox();
+            uint32_t rightCount = 0;
+            for (size_t split = numSahBins - 1; split > 0; split--) {
+                growBox(rightBounds, binBounds[split]);
+                rightCount += binCounts[split];
+                rightCosts[split] = primitiveCost * float(rightCount) * surfaceArea(rightBounds);
+            }
+            AxisAlignedBox leftBounds = emptyBox();
+            uint32_t leftCount = 0;
+            for (size_t split = 1; split < numSahBins; split++) {
+                growBox(leftBounds, binBounds[split - 1]);
+                leftCount += binCounts[split - 1];
+                const float cost = primitiveCost * float(leftCount) * surfaceArea(leftBounds) + rightCosts[split];
+                if (leftCount > 0 && leftCount < numPrimitives && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        const float leafCost = primitiveCost * float(numPrimitives);
+        const float splitCost = sahTraversalCost + bestCost / std::max(surfaceArea(bounds), std::numeric_limits<float>::min());
+        const bool canSplit = numPrimitives > 1 && item.depth < maxTreeDepth;
+        if (!canSplit || (numPrimitives <= leafSize && leafCost <= splitCost)) {
+            tree.nodes[item.nodeIdx].offset = item.begin;
+            tree.nodes[item.nodeIdx].numPrimitives = numPrimitives;
+            tree.numLeaves++;
+            continue;
+        }
+
+        uint32_t middle;
+        if (bestAxis >= 0) {
+            const float binScale = float(numSahBins) / centroidExtent[bestAxis];
+            const auto it = std::partition(std::begin(primitiveIds) + item.begin, std::begin(primitiveIds) + item.end, [&](uint32_t id) {
+                return std::min(size_t((centroids[id][bestAxis] - centroidBounds.lower[bestAxis]) * binScale), numSahBins - 1) < bestSplit;
+            });
+            middle = uint32_t(std::distance(std::begin(primitiveIds), it));
+        } else {
+            // All centroids coincide; split the primitives in two halves.
+            middle = item.begin + numPrimitives / 2;
+        }
+
+        const auto leftChildIdx = uint32_t(tree.nodes.size());
+        tree.nodes[item.nodeIdx].offset = leftChildIdx;
+        tree.nodes.emplace_back();
+        tree.nodes.emplace_back();
+        work.push_back(WorkItem { leftChildIdx + 1, middle, item.end, item.depth + 1 });
+        work.push_back(WorkItem { leftChildIdx, item.begin, middle, item.depth + 1 });
+    }
+
+    tree.primitiveIndices = std::move(primitiveIds);
+
+    // Counting sort of the nodes by depth, deepest first.
+    tree.refitLevelStarts.assign(size_t(tree.numLevels) + 1, 0);
+    for (int depth : nodeDepths)
+        tree.refitLevelStarts[size_t(tree.numLevels - depth) + 1]++;
+    for (size_t level = 1; level < tree.refitLevelStarts.size(); level++)
+        tree.refitLevelStarts[level] += tree.refitLevelStarts[level - 1];
+    tree.refitOrder.resize(tree.nodes.size());
+    std::vector<uint32_t> levelEnds(std::begin(tree.refitLevelStarts), std::end(tree.refitLevelStarts) - 1);
+    for (uint32_t nodeIdx = 0; nodeIdx < tree.nodes.size(); nodeIdx++)
+        tree.refitOrder[levelEnds[size_t(tree.numLevels - nodeDepths[nodeIdx])]++] = nodeIdx;
+
+    tree.buildSahCost = computeSahCost(tree);
+    return tree;
+}
+
+// Recompute the bounds of all nodes from the bounds of the primitives, keeping the topology of the tree.
+// nodeBounds(nodeIdx) returns the box to write, so that both BvhNode::bounds and BvhTree::motionBounds can be refit.
+template <typename PrimitiveBounds, typename NodeBounds>
+static void refitBounds(BvhTree& tree, PrimitiveBounds&& primitiveBounds, NodeBounds&& nodeBounds)
+{
+    for (size_t level = 0; level + 1 < tree.refitLevelStarts.size(); level++) {
+        const int begin = int(tree.refitLevelStarts[level]), end = int(tree.refitLevelStarts[level + 1]);
+#ifdef NDEBUG
+#pragma omp parallel for schedule(static) if (end - begin >= minParallelRefitNodes)
+#endif
+        for (int i = begin; i < end; i++) {
+            const uint32_t nodeIdx = tree.refitOrder[size_t(i)];
+            const BvhNode& node = tree.nodes[nodeIdx];
+            AxisAlignedBox bounds = emptyBox();
+            if (node.isLeaf()) {
+                for (uint32_t j = node.offset; j < node.offset + node.numPrimitives; j++)
+                    growBox(bounds, primitiveBounds(tree.primitiveIndices[j]));
+            } else {
+                growBox(bounds, nodeBounds(node.offset));
+                growBox(bounds, nodeBounds(node.offset + 1));
+            }
+            nodeBounds(nodeIdx) = bounds;
+        }
+    }
+}
+
+// Refit the tree (see refitBounds). Returns false if its quality degraded so much that it should be rebuilt instead.
+template <typename PrimitiveBounds>
+static bool refitTree(BvhTree& tree, PrimitiveBounds&& primitiveBounds)
+{
+    refitBounds(tree, primitiveBounds, [&](uint32_t nodeIdx) -> AxisAlignedBox& { return tree.nodes[nodeIdx].bounds; });
+    return computeSahCost(tree) <= sahRebuildThreshold * tree.buildSahCost;
+}
+
+// Bounds of a node for a ray at the given time.
+static AxisAlignedBox nodeBoundsAt(const BvhTree& tree, uint32_t nodeIdx, float time)
+{
+    const AxisAlignedBox& start = tree.nodes[nodeIdx].bounds;
+    if (tree.motionBounds.empty())
+        return start;
+    const AxisAlignedBox& end = tree.motionBounds[nodeIdx];
+    return AxisAlignedBox { glm::mix(start.lower, end.lower, time), glm::mix(start.upper, end.upper, time) };
+}
+
+// Slab test that returns the distance at which the ray enters the box, without modifying the ray.
+static bool intersectRayWithBox(const AxisAlignedBox& box, const glm::vec3& origin, const glm::vec3& invDirection, float tMax, float& tEntry)
+{
+    const glm::vec3 t0 = (box.lower - origin) * invDirection;
+    const glm::vec3 t1 = (box.upper - origin) * invDirection;
+    const glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+    tEntry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    const float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return tEntry <= tExit;
+}
+
+// Visit the leaves of the tree that the ray passes through, nearest child first. intersectLeaf(leaf, ray) returns
+// whether it found a hit; it shortens ray.t, which prunes the remaining nodes. With AnyHit the traversal stops at
+// the first hit instead (for occlusion queries). Adds the visited nodes to nodesVisited.
+template <bool AnyHit = false, typename IntersectLeaf>
+static bool traverseLeaves(const BvhTree& tree, Ray& ray, uint64_t& nodesVisited, IntersectLeaf&& intersectLeaf)
+{
+    if (tree.nodes.empty())
+        return false;
+
+    const glm::vec3 invDirection = 1.0f / ray.direction;
+    float tEntry;
+    if (!intersectRayWithBox(nodeBoundsAt(tree, 0, ray.time), ray.origin, invDirection, ray.t, tEntry))
+        return false;
+
+    bool hit = false;
+    std::array<uint32_t, traversalStackSize> stack;
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const BvhNode& node = tree.nodes[stack[--stackSize]];
+        nodesVisited++;
+        if (node.isLeaf()) {
+            hit |= intersectLeaf(node, ray);
+            if (AnyHit && hit)
+                return true;
+            continue;
+        }
+
+        float tLeft, tRight;
+        const bool hitLeft = intersectRayWithBox(nodeBoundsAt(tree, node.offset, ray.time), ray.origin, invDirection, ray.t, tLeft);
+        const bool hitRight = intersectRayWithBox(nodeBoundsAt(tree, node.offset + 1, ray.time), ray.origin, invDirection, ray.t, tRight);
+        if (hitLeft && hitRight) {
+            // Visit the nearest child first so that the furthest one can be culled by its hit.
+            const bool leftFirst = tLeft <= tRight;
+            stack[stackSize++] = leftFirst ? node.offset + 1 : node.offset;
+            stack[stackSize++] = leftFirst ? node.offset : node.offset + 1;
+        } else if (hitLeft) {
+            stack[stackSize++] = node.offset;
+        } else if (hitRight) {
+            stack[stackSize++] = node.offset + 1;
+        }
+    }
+    return hit;
+}
+
+// Same as traverseLeaves, calling intersectPrimitive(primitiveIdx, ray) for every primitive of the leaves.
+template <bool AnyHit = false, typename IntersectPrimitive>
+static bool traverseTree(const BvhTree& tree, Ray& ray, uint64_t& nodesVisited, IntersectPrimitive&& intersectPrimitive)
+{
+    return traverseLeaves<AnyHit>(tree, ray, nodesVisited, [&](const BvhNode& leaf, Ray& leafRay) {
+        bool leafHit = false;
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.numPrimitives; i++) {
+            leafHit |= intersectPrimitive(tree.primitiveIndices[i], leafRay);
+            if (AnyHit && leafHit)
+                break;
+        }
+        return leafHit;
+    });
+}
+
+// Call visit(nodeIdx, depth) for every node of the tree, with the root at depth 0. Leaves are visited from left to right.
+template <typename Visit>
+static void forEachNode(const BvhTree& tree, Visit&& visit)
+{
+    if (tree.nodes.empty())
+        return;
+    std::vector<std::pair<uint32_t, int>> stack { { 0, 0 } };
+    while (!stack.empty()) {
+        const auto [nodeIdx, depth] = stack.back();
+        stack.pop_back();
+        visit(nodeIdx, depth);
+        const BvhNode& node = tree.nodes[nodeIdx];
+        if (!node.isLeaf()) {
+            stack.emplace_back(node.offset + 1, depth + 1);
+            stack.emplace_back(node.offset, depth + 1);
+        }
+    }
+}
+
+// The hierarchy most recently built for every scene (see BoundingVolumeHierarchy::ofScene). The version changes
+// whenever a hierarchy is added or removed, so that threads can keep using the result of a lookup until then.
+static std::mutex sceneHierarchiesMutex;
+static std::unordered_map<const Scene*, BoundingVolumeHierarchy*> sceneHierarchies;
+static std::atomic<uint64_t> sceneHierarchiesVersion { 1 };
 
 BoundingVolumeHierarchy::BoundingVolumeHierarchy(Scene* pScene)
     : m_pScene(pScene)
 {
-    // TODO: implement BVH construction.
+    update();
+    std::lock_guard lock { sceneHierarchiesMutex };
+    sceneHierarchies[pScene] = this;
+    sceneHierarchiesVersion.fetch_add(1, std::memory_order_release);
+}
+
+BoundingVolumeHierarchy::~BoundingVolumeHierarchy()
+{
+    std::lock_guard lock { sceneHierarchiesMutex };
+    if (const auto it = sceneHierarchies.find(m_pScene); it != std::end(sceneHierarchies) && it->second == this)
+        sceneHierarchies.erase(it);
+    sceneHierarchiesVersion.fetch_add(1, std::memory_order_release);
+}
+
+BoundingVolumeHierarchy* BoundingVolumeHierarchy::ofScene(const Scene& scene)
+{
+    // Shadow rays look up the hierarchy of their scene (see occluded), so the last lookup of every thread is reused
+    // rather than taking the lock each time.
+    struct Lookup {
+        uint64_t version = 0;
+        const Scene* pScene = nullptr;
+        BoundingVolumeHierarchy* pBvh = nullptr;
+    };
+    static thread_local Lookup lastLookup;
+    const uint64_t version = sceneHierarchiesVersion.load(std::memory_order_acquire);
+    if (lastLookup.version == version && lastLookup.pScene == &scene)
+        return lastLookup.pBvh;
+
+    std::lock_guard lock { sceneHierarchiesMutex };
+    const auto it = sceneHierarchies.find(&scene);
+    lastLookup = Lookup { version, &scene, it != std::end(sceneHierarchies) ? it->second : nullptr };
+    return lastLookup.pBvh;
+}
+
+BoundingVolumeHierarchy::InstanceTransform BoundingVolumeHierarchy::computeInstanceTransform(const glm::mat4& objectToWorld)
+{
+    InstanceTransform transform;
+    transform.objectToWorld = objectToWorld;
+    transform.worldToObject = glm::inverse(objectToWorld);
+    transform.normalToWorld = glm::transpose(glm::inverse(glm::mat3(objectToWorld)));
+    transform.isIdentity = objectToWorld == glm::mat4(1.0f);
+    return transform;
+}
+
+void BoundingVolumeHierarchy::buildMeshTree(uint32_t meshIdx)
+{
+    const Mesh& mesh = m_pScene->meshes[meshIdx];
+    std::vector<AxisAlignedBox> bounds(mesh.triangles.size());
+    std::vector<uint32_t> triangleIds(mesh.triangles.size());
+    std::iota(std::begin(triangleIds), std::end(triangleIds), 0u);
+    for (uint32_t triangleIdx : triangleIds)
+        bounds[triangleIdx] = triangleBounds(mesh, triangleIdx);
+    TraceScope traceScope { "build mesh BVH" };
+    m_meshTrees[meshIdx] = buildTree(std::move(triangleIds), bounds);
+}
+
+void BoundingVolumeHierarchy::update()
+{
+    TraceScope traceScope { "update BVH" };
+    const auto& meshes = m_pScene->meshes;
+    const auto& instances = m_pScene->instances;
+
+    // Bottom level. The meshes are independent, so their trees are built in parallel.
+    if (m_meshTrees.size() != meshes.size()) {
+        m_meshTrees.assign(meshes.size(), BvhTree {});
+#ifdef NDEBUG
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int meshIdx = 0; meshIdx < int(meshes.size()); meshIdx++)
+            buildMeshTree(uint32_t(meshIdx));
+        m_instanceTransforms.clear(); // Forces a rebuild of the top level.
+    }
+
+    // Top level.
+    const auto& spheres = m_pScene->spheres;
+    const bool primitivesChanged = m_instanceTransforms.size() != instances.size() || m_numSpheres != spheres.size();
+    m_instanceTransforms.resize(instances.size());
+    m_numSpheres = spheres.size();
+    bool anyMoving = false;
+    for (uint32_t instanceIdx = 0; instanceIdx < instances.size(); instanceIdx++) {
+        const MeshInstance& instance = instances[instanceIdx];
+        m_instanceTransforms[instanceIdx] = computeInstanceTransform(instance.transform);
+        m_instanceTransforms[instanceIdx].isMoving = instance.motionTransform && *instance.motionTransform != instance.transform;
+        anyMoving |= m_instanceTransforms[instanceIdx].isMoving;
+    }
+    if (primitivesChanged) {
+        // Instances of empty meshes are left out of the tree.
+        m_topLevelPrimitives.clear();
+        for (uint32_t instanceIdx = 0; instanceIdx < instances.size(); instanceIdx++) {
+            if (instances[instanceIdx].meshIdx < m_meshTrees.size() && !m_meshTrees[instances[instanceIdx].meshIdx].nodes.empty())
+                m_topLevelPrimitives.push_back(TopLevelPrimitive { PrimitiveType::Triangle, instanceIdx });
+        }
+        for (uint32_t sphereIdx = 0; sphereIdx < spheres.size(); sphereIdx++)
+            m_topLevelPrimitives.push_back(TopLevelPrimitive { PrimitiveType::Sphere, sphereIdx });
+    }
+
+    const auto primitiveBoundsAt = [&](uint32_t primitiveIdx, float time) {
+        const TopLevelPrimitive& primitive = m_topLevelPrimitives[primitiveIdx];
+        if (primitive.type == PrimitiveType::Sphere)
+            return sphereBounds(spheres[primitive.index]);
+        const MeshInstance& instance = instances[primitive.index];
+        return transformBox(m_meshTrees[instance.meshIdx].nodes[0].bounds, instance.transformAt(time));
+    };
+    // Moving instances are bounded over the whole shutter interval.
+    const auto primitiveBounds = [&](uint32_t primitiveIdx) {
+        AxisAlignedBox bounds = primitiveBoundsAt(primitiveIdx, 0.0f);
+        const TopLevelPrimitive& primitive = m_topLevelPrimitives[primitiveIdx];
+        if (primitive.type == PrimitiveType::Triangle && m_instanceTransforms[primitive.index].isMoving)
+            growBox(bounds, primitiveBoundsAt(primitiveIdx, 1.0f));
+        return bounds;
+    };
+
+    // When only the transforms changed, refitting the existing tree is enough (until its quality degrades).
+    if (primitivesChanged || !refitTree(m_topLevelTree, primitiveBounds)) {
+        TraceScope buildScope { "build top-level BVH" };
+        std::vector<AxisAlignedBox> bounds(m_topLevelPrimitives.size());
+        std::vector<uint32_t> primitiveIds(m_topLevelPrimitives.size());
+        std::iota(std::begin(primitiveIds), std::end(primitiveIds), 0u);
+        for (uint32_t primitiveIdx : primitiveIds)
+            bounds[primitiveIdx] = primitiveBounds(primitiveIdx);
+        m_topLevelTree = buildTree(std::move(primitiveIds), bounds, maxTopLevelLeafSize, topLevelPrimitiveCost);
+    }
+    updateSphereBatch();
+
+    // The topology is chosen for the whole shutter interval; traversal interpolates between the bounds at its start and end.
+    if (anyMoving) {
+        m_topLevelTree.motionBounds.resize(m_topLevelTree.nodes.size());
+        refitBounds(
+            m_topLevelTree, [&](uint32_t primitiveIdx) { return primitiveBoundsAt(primitiveIdx, 0.0f); },
+            [&](uint32_t nodeIdx) -> AxisAlignedBox& { return m_topLevelTree.nodes[nodeIdx].bounds; });
+        refitBounds(
+            m_topLevelTree, [&](uint32_t primitiveIdx) { return primitiveBoundsAt(primitiveIdx, 1.0f); },
+            [&](uint32_t nodeIdx) -> AxisAlignedBox& { return m_topLevelTree.motionBounds[nodeIdx]; });
+    } else {
+        m_topLevelTree.motionBounds.clear();
+    }
+}
+
+void BoundingVolumeHierarchy::updateSphereBatch()
+{
+    const auto& primitiveIndices = m_topLevelTree.primitiveIndices;
+    std::vector<uint32_t> sphereIndices;
+    m_sphereBatchOffsets.resize(primitiveIndices.size() + 1);
+    for (size_t i = 0; i < primitiveIndices.size(); i++) {
+        m_sphereBatchOffsets[i] = uint32_t(sphereIndices.size());
+        const TopLevelPrimitive& primitive = m_topLevelPrimitives[primitiveIndices[i]];
+        if (primitive.type == PrimitiveType::Sphere)
+            sphereIndices.push_back(primitive.index);
+    }
+    m_sphereBatchOffsets.back() = uint32_t(sphereIndices.size());
+    m_sphereBatch = makeSphereBatch(m_pScene->spheres, sphereIndices);
+}
+
+void BoundingVolumeHierarchy::refit()
+{
+    const auto& meshes = m_pScene->meshes;
+    if (m_meshTrees.size() == meshes.size()) {
+        for (uint32_t meshIdx = 0; meshIdx < meshes.size(); meshIdx++) {
+            const Mesh& mesh = meshes[meshIdx];
+            if (!refitTree(m_meshTrees[meshIdx], [&](uint32_t triangleIdx) { return triangleBounds(mesh, triangleIdx); }))
+                buildMeshTree(meshIdx);
+        }
+    }
+    update();
 }
 
 // Return the depth of the tree that you constructed. This is used to tell the
 // slider in the UI how many steps it should display for Visual Debug 1.
+// The levels of the bottom-level trees follow those of the top-level tree.
 int BoundingVolumeHierarchy::numLevels() const
 {
-    return 1;
+    int numMeshLevels = 0;
+    for (const auto& meshTree : m_meshTrees)
+        numMeshLevels = std::max(numMeshLevels, meshTree.numLevels);
+    return std::max(m_topLevelTree.numLevels + numMeshLevels, 1);
 }
 
 // Return the number of leaf nodes in the tree that you constructed. This is used to tell the
 // slider in the UI how many steps it should display for Visual Debug 2.
+// Every instance contributes the leaves of the tree of its mesh, and every sphere counts as a leaf of its own.
 int BoundingVolumeHierarchy::numLeaves() const
 {
-    return 1;
+    int numLeaves = 0;
+    for (uint32_t primitiveIdx : m_topLevelTree.primitiveIndices) {
+        const TopLevelPrimitive& primitive = m_topLevelPrimitives[primitiveIdx];
+        numLeaves += primitive.type == PrimitiveType::Sphere ? 1 : m_meshTrees[m_pScene->instances[primitive.index].meshIdx].numLeaves;
+    }
+    return std::max(numLeaves, 1);
+}
+
+// Memory allocated by a vector.
+template <typename T>
+static size_t vectorBytes(const std::vector<T>& vector)
+{
+    return vector.capacity() * sizeof(T);
+}
+
+static BvhTreeQuality computeTreeQuality(const BvhTree& tree)
+{
+    BvhTreeQuality quality;
+    quality.sahCost = computeSahCost(tree);
+    quality.numNodes = uint32_t(tree.nodes.size());
+    quality.numPrimitives = uint32_t(tree.primitiveIndices.size());
+    quality.memoryBytes = sizeof(BvhTree) + vectorBytes(tree.nodes) + vectorBytes(tree.primitiveIndices) + vectorBytes(tree.refitOrder)
+        + vectorBytes(tree.refitLevelStarts) + vectorBytes(tree.motionBounds);
+    if (tree.nodes.empty())
+        return quality;
+
+    float overlapArea = 0.0f;
+    std::vector<std::pair<uint32_t, uint32_t>> stack { { 0u, 0u } }; // Node and its depth.
+    while (!stack.empty()) {
+        const auto [nodeIdx, depth] = stack.back();
+        stack.pop_back();
+        const BvhNode& node = tree.nodes[nodeIdx];
+        if (node.isLeaf()) {
+            quality.numLeaves++;
+            quality.leafSizes.resize(std::max(quality.leafSizes.size(), size_t(node.numPrimitives) + 1), 0);
+            quality.leafSizes[node.numPrimitives]++;
+            quality.leafDepths.resize(std::max(quality.leafDepths.size(), size_t(depth) + 1), 0);
+            quality.leafDepths[depth]++;
+            continue;
+        }
+
+        const AxisAlignedBox& left = tree.nodes[node.offset].bounds;
+        const AxisAlignedBox& right = tree.nodes[node.offset + 1].bounds;
+        const AxisAlignedBox overlap { glm::max(left.lower, right.lower), glm::min(left.upper, right.upper) };
+        if (glm::all(glm::lessThanEqual(overlap.lower, overlap.upper)))
+            overlapArea += surfaceArea(overlap);
+        stack.emplace_back(node.offset, depth + 1);
+        stack.emplace_back(node.offset + 1, depth + 1);
+    }
+    quality.siblingOverlap = overlapArea / std::max(surfaceArea(tree.nodes[0].bounds), std::numeric_limits<float>::min());
+    return quality;
+}
+
+BvhQualityReport BoundingVolumeHierarchy::qualityReport() const
+{
+    BvhQualityReport report;
+    report.topLevel = computeTreeQuality(m_topLevelTree);
+    report.memoryBytes = report.topLevel.memoryBytes + vectorBytes(m_topLevelPrimitives) + vectorBytes(m_instanceTransforms)
+        + vectorBytes(m_sphereBatchOffsets) + vectorBytes(m_sphereBatch.centerX) + vectorBytes(m_sphereBatch.centerY)
+        + vectorBytes(m_sphereBatch.centerZ) + vectorBytes(m_sphereBatch.radius) + vectorBytes(m_sphereBatch.materials)
+        + vectorBytes(m_sphereBatch.sphereIndices);
+    for (const BvhTree& meshTree : m_meshTrees) {
+        BvhTreeQuality& quality = report.meshes.emplace_back(computeTreeQuality(meshTree));
+        addHistogram(report.meshLeafSizes, quality.leafSizes);
+        addHistogram(report.meshLeafDepths, quality.leafDepths);
+        report.memoryBytes += quality.memoryBytes;
+    }
+    return report;
 }
 
 // Use this function to visualize your BVH. This is useful for debugging. Use the functions in
@@ -32,14 +609,26 @@ int BoundingVolumeHierarchy::numLeaves() const
 // mode, arbitrary colors and transparency.
 void BoundingVolumeHierarchy::debugDrawLevel(int level)
 {
-    // Draw the AABB as a transparent green box.
-    //AxisAlignedBox aabb{ glm::vec3(-0.05f), glm::vec3(0.05f, 1.05f, 1.05f) };
-    //drawShape(aabb, DrawMode::Filled, glm::vec3(0.0f, 1.0f, 0.0f), 0.2f);
+    if (level < m_topLevelTree.numLevels) {
+        forEachNode(m_topLevelTree, [&](uint32_t nodeIdx, int depth) {
+            if (depth == level)
+                drawAABB(m_topLevelTree.nodes[nodeIdx].bounds, DrawMode::Filled, glm::vec3(0.05f, 1.0f, 0.05f), 0.1f);
+        });
+        return;
+    }
 
-    // Draw the AABB as a (white) wireframe box.
-    AxisAlignedBox aabb { glm::vec3(0.0f), glm::vec3(0.0f, 1.05f, 1.05f) };
-    //drawAABB(aabb, DrawMode::Wireframe);
-    drawAABB(aabb, DrawMode::Filled, glm::vec3(0.05f, 1.0f, 0.05f), 0.1f);
+    // Below the top-level tree, draw the nodes of the bottom-level trees in world space.
+    const int meshLevel = level - m_topLevelTree.numLevels;
+    for (uint32_t primitiveIdx : m_topLevelTree.primitiveIndices) {
+        if (m_topLevelPrimitives[primitiveIdx].type != PrimitiveType::Triangle)
+            continue;
+        const uint32_t instanceIdx = m_topLevelPrimitives[primitiveIdx].index;
+        const BvhTree& meshTree = m_meshTrees[m_pScene->instances[instanceIdx].meshIdx];
+        forEachNode(meshTree, [&](uint32_t nodeIdx, int depth) {
+            if (depth == meshLevel)
+                drawAABB(transformBox(meshTree.nodes[nodeIdx].bounds, m_instanceTransforms[instanceIdx].objectToWorld), DrawMode::Filled, glm::vec3(0.05f, 1.0f, 0.05f), 0.1f);
+        });
+    }
 }
 
 
@@ -49,18 +638,126 @@ void BoundingVolumeHierarchy::debugDrawLevel(int level)
 // i-th leaf node in the vector.
 void BoundingVolumeHierarchy::debugDrawLeaf(int leafIdx)
 {
-    // Draw the AABB as a transparent green box.
-    //AxisAlignedBox aabb{ glm::vec3(-0.05f), glm::vec3(0.05f, 1.05f, 1.05f) };
-    //drawShape(aabb, DrawMode::Filled, glm::vec3(0.0f, 1.0f, 0.0f), 0.2f);
+    // The slider in the UI starts counting at 1.
+    int remaining = leafIdx - 1;
+    for (uint32_t primitiveIdx : m_topLevelTree.primitiveIndices) {
+        const TopLevelPrimitive& primitive = m_topLevelPrimitives[primitiveIdx];
+        if (primitive.type == PrimitiveType::Sphere) {
+            if (remaining-- == 0) {
+                const Sphere& sphere = m_pScene->spheres[primitive.index];
+                drawAABB(sphereBounds(sphere), DrawMode::Filled, glm::vec3(0.05f, 1.0f, 0.05f), 0.1f);
+                drawSphere(sphere);
+                return;
+            }
+            continue;
+        }
+
+        const uint32_t instanceIdx = primitive.index;
+        const uint32_t meshIdx = m_pScene->instances[instanceIdx].meshIdx;
+        const BvhTree& meshTree = m_meshTrees[meshIdx];
+        if (remaining >= meshTree.numLeaves) {
+            remaining -= meshTree.numLeaves;
+            continue;
+        }
+
+        const InstanceTransform& transform = m_instanceTransforms[instanceIdx];
+        const Mesh& mesh = m_pScene->meshes[meshIdx];
+        forEachNode(meshTree, [&](uint32_t nodeIdx, int) {
+            const BvhNode& node = meshTree.nodes[nodeIdx];
+            if (!node.isLeaf() || remaining-- != 0)
+                return;
+            drawAABB(transformBox(node.bounds, transform.objectToWorld), DrawMode::Filled, glm::vec3(0.05f, 1.0f, 0.05f), 0.1f);
+            for (uint32_t i = node.offset; i < node.offset + node.numPrimitives; i++) {
+                const glm::uvec3& tri = mesh.triangles[meshTree.primitiveIndices[i]];
+                std::array<Vertex, 3> vertices;
+                for (size_t j = 0; j < 3; j++) {
+                    const Vertex& vertex = mesh.vertices[tri[glm::length_t(j)]];
+                    vertices[j] = Vertex { glm::vec3(transform.objectToWorld * glm::vec4(vertex.position, 1.0f)), glm::normalize(transform.normalToWorld * vertex.normal), vertex.texCoord };
+                }
+                drawTriangle(vertices[0], vertices[1], vertices[2]);
+            }
+        });
+        return;
+    }
+}
+
+// Intersect the ray with the mesh of one instance, in the object space of that mesh. The direction is not
+// normalized after transforming it, so that t is the same in object and world space. Moving instances are
+// intersected where they are at the time of the ray. intersectTriangles(meshIdx, objectRay, intersectTriangle)
+// chooses the triangles: it calls intersectTriangle(triangleIdx, objectRay) for them and returns whether any was hit.
+template <typename IntersectTriangles>
+bool BoundingVolumeHierarchy::intersectInstance(uint32_t instanceIdx, Ray& ray, HitInfo& hitInfo, TraversalStatistics& statistics, IntersectTriangles&& intersectTriangles) const
+{
+    const MeshInstance& instance = m_pScene->instances[instanceIdx];
+    const uint32_t meshIdx = instance.meshIdx;
+    const Mesh& mesh = m_pScene->meshes[meshIdx];
+    const InstanceTransform* pTransform = &m_instanceTransforms[instanceIdx];
+    InstanceTransform movingTransform;
+    if (pTransform->isMoving) {
+        movingTransform = computeInstanceTransform(instance.transformAt(ray.time));
+        pTransform = &movingTransform;
+    }
+    const InstanceTransform& transform = *pTransform;
+
+    Ray objectRay = ray;
+    if (!transform.isIdentity) {
+        objectRay.origin = glm::vec3(transform.worldToObject * glm::vec4(ray.origin, 1.0f));
+        objectRay.direction = glm::mat3(transform.worldToObject) * ray.direction;
+    }
+
+    const auto intersectTriangle = [&](uint32_t triangleIdx, Ray& triangleRay) {
+        statistics.primitivesTested++;
+        const auto& tri = mesh.triangles[triangleIdx];
+        const glm::vec3& v0 = mesh.vertices[tri[0]].position;
+        const glm::vec3& v1 = mesh.vertices[tri[1]].position;
+        const glm::vec3& v2 = mesh.vertices[tri[2]].position;
+        if (!intersectRayWithTriangle(v0, v1, v2, triangleRay, hitInfo))
+            return false;
+        hitInfo.normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+        hitInfo.primitive = { PrimitiveType::Triangle, meshIdx, triangleIdx, instanceIdx };
+        return true;
+    };
 
-    // Draw the AABB as a (white) wireframe box.
-    AxisAlignedBox aabb { glm::vec3(0.0f), glm::vec3(0.0f, 1.05f, 1.05f) };
-    //drawAABB(aabb, DrawMode::Wireframe);
-    drawAABB(aabb, DrawMode::Filled, glm::vec3(0.05f, 1.0f, 0.05f), 0.1f);
+    if (!intersectTriangles(meshIdx, objectRay, intersectTriangle))
+        return false;
 
-    // once you find the leaf node, you can use the function drawTriangle (from draw.h) to draw the contained primitives
+    ray.t = objectRay.t;
+    hitInfo.material = mesh.material;
+    if (!transform.isIdentity)
+        hitInfo.normal = glm::normalize(transform.normalToWorld * hitInfo.normal);
+    return true;
 }
 
+bool BoundingVolumeHierarchy::intersectPrimitive(const PrimitiveRef& primitive, Ray& ray, HitInfo& hitInfo) const
+{
+    TraversalStatistics statistics;
+    return intersectPrimitive(primitive, ray, hitInfo, statistics);
+}
+
+// Uses the stored transform of the instance and the arithmetic of the sphere kernel, like the traversal.
+bool BoundingVolumeHierarchy::intersectPrimitive(const PrimitiveRef& primitive, Ray& ray, HitInfo& hitInfo, TraversalStatistics& statistics) const
+{
+    if (primitive.type == PrimitiveType::Triangle) {
+        if (primitive.instanceIdx >= m_instanceTransforms.size())
+            return false;
+        const uint32_t meshIdx = m_pScene->instances[primitive.instanceIdx].meshIdx;
+        if (meshIdx != primitive.meshIdx || primitive.primitiveIdx >= m_pScene->meshes[meshIdx].triangles.size())
+            return false;
+        return intersectInstance(primitive.instanceIdx, ray, hitInfo, statistics, [&](uint32_t, Ray& objectRay, const auto& intersectTriangle) {
+            return intersectTriangle(primitive.primitiveIdx, objectRay);
+        });
+    } else if (primitive.type == PrimitiveType::Sphere && primitive.primitiveIdx < m_numSpheres) {
+        statistics.primitivesTested++;
+        const Sphere& sphere = m_pScene->spheres[primitive.primitiveIdx];
+        if (!intersectRayWithSphere(sphere, ray))
+            return false;
+        hitInfo.normal = glm::normalize(ray.origin + ray.t * ray.direction - sphere.center);
+        hitInfo.material = sphere.material;
+        hitInfo.primitive = primitive;
+        return true;
+    }
+    return false;
+}
 
 // Return true if something is hit, returns false otherwise. Only find hits if they are closer than t stored
 // in the ray and if the intersection is on the correct side of the origin (the new t >= 0). Replace the code
@@ -68,29 +765,97 @@ void BoundingVolumeHierarchy::debugDrawLeaf(int leafIdx)
 // file you like, including bounding_volume_hierarchy.h.
 bool BoundingVolumeHierarchy::intersect(Ray& ray, HitInfo& hitInfo, const Features& features) const
 {
-    // If BVH is not enabled, use the naive implementation.
-    if (!features.enableAccelStructure) {
-        bool hit = false;
-        // Intersect with all triangles of all meshes.
-        for (const auto& mesh : m_pScene->meshes) {
-            for (const auto& tri : mesh.triangles) {
-                const auto v0 = mesh.vertices[tri[0]];
-                const auto v1 = mesh.vertices[tri[1]];
-                const auto v2 = mesh.vertices[tri[2]];
-                if (intersectRayWithTriangle(v0.position, v1.position, v2.position, ray, hitInfo)) {
-                    hitInfo.material = mesh.material;
-                    hit = true;
-                }
+    TraversalStatistics statistics;
+    const float tMax = ray.t;
+    const auto closestTriangle = [&](uint32_t meshIdx, Ray& objectRay, const auto& intersectTriangle) {
+        return traverseTree(m_meshTrees[meshIdx], objectRay, statistics.nodesVisited, intersectTriangle);
+    };
+    bool hit = false;
+    if (features.enableAccelStructure) {
+        hit = traverseLeaves(m_topLevelTree, ray, statistics.nodesVisited, [&](const BvhNode& leaf, Ray& leafRay) {
+            bool leafHit = false;
+            for (uint32_t i = leaf.offset; i < leaf.offset + leaf.numPrimitives; i++) {
+                const TopLevelPrimitive& primitive = m_topLevelPrimitives[m_topLevelTree.primitiveIndices[i]];
+                if (primitive.type == PrimitiveType::Triangle)
+                    leafHit |= intersectInstance(primitive.index, leafRay, hitInfo, statistics, closestTriangle);
             }
-        }
-        // Intersect with spheres.
-        for (const auto& sphere : m_pScene->spheres)
-            hit |= intersectRayWithShape(sphere, ray, hitInfo);
-        return hit;
+            // All spheres of the leaf are tested at once.
+            const uint32_t sphereBegin = m_sphereBatchOffsets[leaf.offset], sphereEnd = m_sphereBatchOffsets[leaf.offset + leaf.numPrimitives];
+            statistics.primitivesTested += sphereEnd - sphereBegin;
+            if (const int position = intersectRayWithSpheres(m_sphereBatch, sphereBegin, sphereEnd, leafRay); position >= 0) {
+                computeSphereHitInfo(m_sphereBatch, uint32_t(position), leafRay, hitInfo);
+                leafHit = true;
+            }
+            return leafHit;
+        });
     } else {
-        // TODO: implement here the bounding volume hierarchy traversal.
-        // Please note that you should use `features.enableNormalInterp` and `features.enableTextureMapping`
-        // to isolate the code that is only needed for the normal interpolation and texture mapping features.
-        return false;
+        // If BVH is not enabled, use the naive implementation: intersect with all triangles of all instances and all spheres.
+        const auto allTriangles = [&](uint32_t meshIdx, Ray& objectRay, const auto& intersectTriangle) {
+            bool meshHit = false;
+            for (uint32_t triangleIdx = 0; triangleIdx < m_pScene->meshes[meshIdx].triangles.size(); triangleIdx++)
+                meshHit |= intersectTriangle(triangleIdx, objectRay);
+            return meshHit;
+        };
+        for (uint32_t instanceIdx = 0; instanceIdx < m_pScene->instances.size(); instanceIdx++)
+            hit |= intersectInstance(instanceIdx, ray, hitInfo, statistics, allTriangles);
+        statistics.primitivesTested += m_sphereBatch.size();
+        if (const int position = intersectRayWithSpheres(m_sphereBatch, 0, m_sphereBatch.size(), ray); position >= 0) {
+            computeSphereHitInfo(m_sphereBatch, uint32_t(position), ray, hitInfo);
+            hit = true;
+        }
+    }
+    countTracedRay(hit, statistics.nodesVisited, statistics.primitivesTested);
+    if (features.heatmap != HeatmapMode::None)
+        addThreadTraversalCost(statistics.nodesVisited, statistics.primitivesTested);
+    if (rayRecordingEnabled())
+        recordTracedRay(ray, tMax, hit, hitInfo);
+    return hit;
+}
+
+bool BoundingVolumeHierarchy::occluded(Ray& ray, const Features& features, PrimitiveRef& occluder) const
+{
+    TraversalStatistics statistics;
+    const float tMax = ray.t;
+    HitInfo hitInfo;
+    bool hit = occluder.type != PrimitiveType::None && intersectPrimitive(occluder, ray, hitInfo, statistics);
+    if (!hit) {
+        const auto anyTriangle = [&](uint32_t meshIdx, Ray& objectRay, const auto& intersectTriangle) {
+            if (features.enableAccelStructure)
+                return traverseTree<true>(m_meshTrees[meshIdx], objectRay, statistics.nodesVisited, intersectTriangle);
+            for (uint32_t triangleIdx = 0; triangleIdx < m_pScene->meshes[meshIdx].triangles.size(); triangleIdx++) {
+                if (intersectTriangle(triangleIdx, objectRay))
+                    return true;
+            }
+            return false;
+        };
+        const auto anyPrimitive = [&](std::span<const uint32_t> primitiveIndices, uint32_t sphereBegin, uint32_t sphereEnd, Ray& leafRay) {
+            for (uint32_t primitiveIdx : primitiveIndices) {
+                const TopLevelPrimitive& primitive = m_topLevelPrimitives[primitiveIdx];
+                if (primitive.type == PrimitiveType::Triangle && intersectInstance(primitive.index, leafRay, hitInfo, statistics, anyTriangle))
+                    return true;
+            }
+            statistics.primitivesTested += sphereEnd - sphereBegin;
+            if (const int position = intersectRayWithSpheres(m_sphereBatch, sphereBegin, sphereEnd, leafRay); position >= 0) {
+                computeSphereHitInfo(m_sphereBatch, uint32_t(position), leafRay, hitInfo);
+                return true;
+            }
+            return false;
+        };
+        if (features.enableAccelStructure) {
+            hit = traverseLeaves<true>(m_topLevelTree, ray, statistics.nodesVisited, [&](const BvhNode& leaf, Ray& leafRay) {
+                return anyPrimitive(std::span(m_topLevelTree.primitiveIndices).subspan(leaf.offset, leaf.numPrimitives),
+                    m_sphereBatchOffsets[leaf.offset], m_sphereBatchOffsets[leaf.offset + leaf.numPrimitives], leafRay);
+            });
+        } else {
+            hit = anyPrimitive(m_topLevelTree.primitiveIndices, 0, m_sphereBatch.size(), ray);
+        }
+        if (hit)
+            occluder = hitInfo.primitive;
     }
-}
\ No newline at end of file
+    countTracedRay(hit, statistics.nodesVisited, statistics.primitivesTested);
+    if (features.heatmap != HeatmapMode::None)
+        addThreadTraversalCost(statistics.nodesVisited, statistics.primitivesTested);
+    if (rayRecordingEnabled())
+        recordTracedRay(ray, tMax, hit, hitInfo, RayQuery::AnyHit);
+    return hit;
+}
@@ -1,16 +1,80 @@
 #pragma once
+#include "bvh_quality.h"
 #include "common.h"
+#include "sphere_batch.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+DISABLE_WARNINGS_POP()
 #include <array>
 #include <framework/ray.h>
+#include <span>
 #include <vector>
 
 // Forward declaration.
 struct Scene;
 
+// Node of a BvhTree. The two children of an interior node are stored next to each other in the node array,
+// so a node only needs to know where the first one is.
+struct BvhNode {
+    AxisAlignedBox bounds;
+    // Interior node: index of the left child (the right child is at offset + 1).
+    // Leaf: index of its first primitive in BvhTree::primitiveIndices.
+    uint32_t offset = 0;
+    uint32_t numPrimitives = 0; // Zero for interior nodes.
+
+    [[nodiscard]] bool isLeaf() const { return numPrimitives > 0; }
+};
+
+// Binary tree over a set of primitives, built with the binned surface area heuristic. nodes[0] is the root;
+// the tree is empty (no nodes) if there were no primitives.
+struct BvhTree {
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> primitiveIndices;
+    int numLevels = 0;
+    int numLeaves = 0;
+
+    // All nodes grouped by depth, deepest level first: refitOrder[refitLevelStarts[i]..refitLevelStarts[i + 1]).
+    // Refitting a level only reads nodes of the level before it, so the nodes of a level can be refit in parallel.
+    std::vector<uint32_t> refitOrder;
+    std::vector<uint32_t> refitLevelStarts;
+    // SAH cost right after the build; refits rebuild the tree once its cost has degraded too far past this.
+    float buildSahCost = 0.0f;
+
+    // For trees over primitives that move while the shutter is open: the bounds of every node at the end of the
+    // shutter interval, while BvhNode::bounds holds those at the start. A ray at time t tests the box interpolated
+    // between the two. Empty if nothing in the tree moves.
+    std::vector<AxisAlignedBox> motionBounds;
+};
+
+// Two-level hierarchy: every mesh has a bottom-level tree over its triangles in object space, and a top-level tree
+// is built over the instances of the scene (see MeshInstance) and its analytic primitives (spheres). Rays are
+// transformed into the object space of an instance when traversal reaches it, so the instances of a mesh share its
+// tree; analytic primitives are intersected directly in the leaves of the top-level tree (spheres in batches, see
+// SphereBatch). Instances that move while
+// the shutter is open (motion blur) are bounded over the whole interval by interpolating the top-level boxes.
 class BoundingVolumeHierarchy {
 public:
     // Constructor. Receives the scene and builds the bounding volume hierarchy.
     BoundingVolumeHierarchy(Scene* pScene);
+    ~BoundingVolumeHierarchy();
+
+    // The hierarchy most recently built for the scene, or nullptr if there is none. BvhInterface only exposes what
+    // the assignment asks of the BVH and is not to be changed, so the functions below that it lacks (update, refit,
+    // qualityReport, occluded) are reached through the scene instead.
+    [[nodiscard]] static BoundingVolumeHierarchy* ofScene(const Scene& scene);
+
+    // Bring the hierarchy up to date after instances were moved, added or removed (e.g. between animation frames).
+    // The bottom-level trees are kept (unless the number of meshes changed). The top-level tree is refit when only
+    // the transforms changed, and rebuilt otherwise or when the refit degraded its quality too much.
+    void update();
+
+    // Bring the hierarchy up to date after vertices of the meshes moved without changing the triangles (deforming
+    // meshes). The trees keep their topology and only have their bounds recomputed, except for trees whose
+    // SAH cost degraded too much, which are rebuilt. Also calls update().
+    void refit();
 
     // Return how many levels there are in the tree that you have constructed.
     [[nodiscard]] int numLevels() const;
@@ -18,6 +82,9 @@ public:
     // Return how many leaf nodes there are in the tree that you have constructed.
     [[nodiscard]] int numLeaves() const;
 
+    // Measure the quality of the top-level tree and of the tree of every mesh (see bvh_quality.h).
+    [[nodiscard]] BvhQualityReport qualityReport() const;
+
     // Visual Debug 1: Draw the bounding boxes of the nodes at the selected level.
     void debugDrawLevel(int level);
 
@@ -29,9 +96,56 @@ public:
     // is on the correct side of the origin (the new t >= 0).
     bool intersect(Ray& ray, HitInfo& hitInfo, const Features& features) const;
 
+    // Occlusion query (e.g. for shadow rays): return true if anything is hit closer than ray.t, stopping at the
+    // first hit found, which need not be the closest (ray.t is set to its distance). occluder is tested first if
+    // set, since rays from nearby points are often blocked by the same primitive, and is set to the primitive hit.
+    bool occluded(Ray& ray, const Features& features, PrimitiveRef& occluder) const;
+
+    // Intersect the ray with one primitive exactly as the traversal does, so that it is hit exactly when intersect
+    // would find it (given that it is closer than the other hits). References to primitives that are not in the
+    // hierarchy are never hit.
+    bool intersectPrimitive(const PrimitiveRef& primitive, Ray& ray, HitInfo& hitInfo) const;
+
 
 private:
-    int m_numLevels;
-    int m_numLeaves;
+    // Primitive of the top-level tree: an instance of a mesh (PrimitiveType::Triangle) or a sphere, by its index
+    // in Scene::instances or Scene::spheres.
+    struct TopLevelPrimitive {
+        PrimitiveType type;
+        uint32_t index;
+    };
+
+    // Transforms of an instance, derived from MeshInstance::transform.
+    struct InstanceTransform {
+        glm::mat4 objectToWorld { 1.0f };
+        glm::mat4 worldToObject { 1.0f };
+        glm::mat3 normalToWorld { 1.0f };
+        bool isIdentity = true;
+        bool isMoving = false; // Moving instances compute their transforms at the time of each ray instead.
+    };
+
+    // Work done while intersecting one ray, for the ray statistics (see ray_statistics.h).
+    struct TraversalStatistics {
+        uint64_t nodesVisited = 0;
+        uint64_t primitivesTested = 0;
+    };
+
+    static InstanceTransform computeInstanceTransform(const glm::mat4& objectToWorld);
+
+    void buildMeshTree(uint32_t meshIdx);
+    template <typename IntersectTriangles>
+    bool intersectInstance(uint32_t instanceIdx, Ray& ray, HitInfo& hitInfo, TraversalStatistics& statistics, IntersectTriangles&& intersectTriangles) const;
+    bool intersectPrimitive(const PrimitiveRef& primitive, Ray& ray, HitInfo& hitInfo, TraversalStatistics& statistics) const;
+    void updateSphereBatch();
+
     Scene* m_pScene;
-};
\ No newline at end of file
+    std::vector<BvhTree> m_meshTrees; // Bottom level: one tree per mesh.
+    BvhTree m_topLevelTree; // Top level: a tree over m_topLevelPrimitives.
+    std::vector<TopLevelPrimitive> m_topLevelPrimitives;
+    std::vector<InstanceTransform> m_instanceTransforms;
+    size_t m_numSpheres = 0;
+    // The spheres in the order in which the leaves of the top-level tree reference them, so that the spheres of a
+    // leaf are contiguous. The spheres of the leaf at primitiveIndices[i..j) are m_sphereBatch[m_sphereBatchOffsets[i]..m_sphereBatchOffsets[j]).
+    SphereBatch m_sphereBatch;
+    std::vector<uint32_t> m_sphereBatchOffsets;
+};
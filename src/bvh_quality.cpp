@@ -0,0 +1,38 @@
+#include "bvh_quality.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/core.h>
+#include <fmt/ranges.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <ostream>
+#include <string>
+
+void addHistogram(std::vector<uint32_t>& histogram, const std::vector<uint32_t>& other)
+{
+    histogram.resize(std::max(histogram.size(), other.size()), 0);
+    for (size_t i = 0; i < other.size(); i++)
+        histogram[i] += other[i];
+}
+
+static std::string treeQualityJson(const BvhTreeQuality& quality)
+{
+    return fmt::format(
+        "{{ \"sah_cost\": {:.4f}, \"sibling_overlap\": {:.4f}, \"nodes\": {}, \"leaves\": {}, \"primitives\": {}, "
+        "\"leaf_sizes\": [{}], \"leaf_depths\": [{}], \"memory_bytes\": {} }}",
+        quality.sahCost, quality.siblingOverlap, quality.numNodes, quality.numLeaves, quality.numPrimitives,
+        fmt::join(quality.leafSizes, ", "), fmt::join(quality.leafDepths, ", "), quality.memoryBytes);
+}
+
+void writeBvhQualityReportJson(std::ostream& os, const BvhQualityReport& report)
+{
+    os << "{\n  \"top_level\": " << treeQualityJson(report.topLevel) << ",\n"
+       << "  \"meshes\": [";
+    for (size_t meshIdx = 0; meshIdx < report.meshes.size(); meshIdx++)
+        os << (meshIdx == 0 ? "\n    " : ",\n    ") << treeQualityJson(report.meshes[meshIdx]);
+    os << "\n  ],\n"
+       << fmt::format("  \"mesh_leaf_sizes\": [{}],\n", fmt::join(report.meshLeafSizes, ", "))
+       << fmt::format("  \"mesh_leaf_depths\": [{}],\n", fmt::join(report.meshLeafDepths, ", "))
+       << "  \"memory_bytes\": " << report.memoryBytes << "\n}\n";
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// Measures of the quality of the trees of the BVH (see BoundingVolumeHierarchy::qualityReport), to compare builders
+// and their parameters on real meshes rather than by looking at debugDrawLevel.
+struct BvhTreeQuality {
+    // Expected cost of tracing a ray through the tree (node visits plus primitive tests), relative to the area of
+    // the root. The builder minimizes this.
+    float sahCost = 0.0f;
+    // Area of the overlap of the two children of every interior node, summed and relative to the area of the root.
+    // A ray through the overlap has to visit both children.
+    float siblingOverlap = 0.0f;
+    uint32_t numNodes = 0;
+    uint32_t numLeaves = 0;
+    uint32_t numPrimitives = 0;
+    // leafSizes[n] is the number of leaves with n primitives, leafDepths[d] the number of leaves at depth d (the
+    // root is at depth 0).
+    std::vector<uint32_t> leafSizes;
+    std::vector<uint32_t> leafDepths;
+    size_t memoryBytes = 0;
+};
+
+struct BvhQualityReport {
+    BvhTreeQuality topLevel; // Over the instances and spheres of the scene.
+    std::vector<BvhTreeQuality> meshes; // Bottom level, per mesh.
+    // The histograms of all bottom-level trees together.
+    std::vector<uint32_t> meshLeafSizes;
+    std::vector<uint32_t> meshLeafDepths;
+    // Of all trees, plus the instance transforms and the sphere batch.
+    size_t memoryBytes = 0;
+};
+
+// Add the counts of a histogram to another, growing it if needed.
+void addHistogram(std::vector<uint32_t>& histogram, const std::vector<uint32_t>& other);
+
+void writeBvhQualityReportJson(std::ostream& os, const BvhQualityReport& report);
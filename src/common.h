@@ -4,6 +4,7 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
+#include <cstdint>
 #include <framework/mesh.h>
 
 enum class DrawMode {
@@ -11,11 +12,35 @@ enum class DrawMode {
     Wireframe
 };
 
+// What a heatmap render shows per pixel instead of its colour (see heatmap.h).
+enum class HeatmapMode {
+    None,
+    NodesVisited,
+    PrimitivesTested,
+    Time
+};
+
+enum class PrimitiveType {
+    None,
+    Triangle,
+    Sphere
+};
+
+// Identifies a primitive of the scene: a triangle of one of the mesh instances, or one of the spheres.
+struct PrimitiveRef {
+    PrimitiveType type = PrimitiveType::None;
+    uint32_t meshIdx = 0; // Only used for triangles.
+    uint32_t primitiveIdx = 0; // Index of the triangle in the mesh, or of the sphere in scene.spheres.
+    uint32_t instanceIdx = 0; // Only used for triangles: the instance of the mesh (see MeshInstance).
+};
+
 struct HitInfo {
     glm::vec3 normal;
     glm::vec3 barycentricCoord;
     glm::vec2 texCoord;
     Material material;
+    // The primitive that was hit (set by BoundingVolumeHierarchy::intersect).
+    PrimitiveRef primitive;
 };
 
 struct Plane {
@@ -73,5 +98,21 @@ struct Features {
     bool enableTextureMapping = false;
     bool enableAccelStructure = false;
 
+    // Importance sample a fixed number of lights per shading point instead of looping over all of them.
+    bool enableLightSampling = false;
+    int numLightSamples = 8;
+
+    // Maximum number of reflections traced by the recursive ray tracer, optionally cut short by Russian roulette.
+    int maxRayDepth = 5;
+    bool enableRussianRoulette = false;
+
+    // Render breadth first (see wavefront.h) instead of following every pixel depth first through getFinalColor.
+    bool enableWavefront = false;
+    // Bin the secondary rays of the wavefront renderer by origin and direction before tracing them (see ray_stream.h).
+    bool enableRaySorting = false;
+
+    // Render the cost of every pixel as a heatmap instead of its colour.
+    HeatmapMode heatmap = HeatmapMode::None;
+
     ExtraFeatures extra = {};
 };
\ No newline at end of file
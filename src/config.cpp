@@ -9,6 +9,7 @@ DISABLE_WARNINGS_PUSH()
 DISABLE_WARNINGS_POP()
 
 #include <algorithm>
+#include <array>
 #include <cctype>
 #include <iostream>
 
@@ -60,6 +61,16 @@ static std::ostream& operator<<(std::ostream& os, const SceneType& sceneType)
     return os;
 }
 
+// Names of the heatmap modes in the config file, in the order of HeatmapMode.
+static constexpr std::array heatmapModeNames { "none", "nodes", "primitives", "time" };
+
+// Helper function to print HeatmapMode.
+static std::ostream& operator<<(std::ostream& os, const HeatmapMode& heatmapMode)
+{
+    os << heatmapModeNames[size_t(heatmapMode)];
+    return os;
+}
+
 // Helper function to print a glm::vec3.
 static std::ostream& operator<<(std::ostream& os, const glm::vec3& vec3)
 {
@@ -84,6 +95,10 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
     }
 
     os << "  + output_filepath: " << config.outputDir << std::endl
+       << "  + output_format: " << config.outputFormat << std::endl
+       << "  + trace_file: " << config.traceFile << std::endl
+       << "  + ray_dump_file: " << config.rayDumpFile << std::endl
+       << "  + bvh_report_file: " << config.bvhReportFile << std::endl
        << "  + features: " << std::endl
        << "    - enable_shading: " << config.features.enableShading << std::endl
        << "    - enable_recursive: " << config.features.enableRecursive << std::endl
@@ -92,6 +107,13 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
        << "    - enable_normal_interp: " << config.features.enableNormalInterp << std::endl
        << "    - enable_texture_mapping: " << config.features.enableTextureMapping << std::endl
        << "    - enable_accel_structure: " << config.features.enableAccelStructure << std::endl
+       << "    - enable_light_sampling: " << config.features.enableLightSampling << std::endl
+       << "    - num_light_samples: " << config.features.numLightSamples << std::endl
+       << "    - max_ray_depth: " << config.features.maxRayDepth << std::endl
+       << "    - enable_russian_roulette: " << config.features.enableRussianRoulette << std::endl
+       << "    - enable_wavefront: " << config.features.enableWavefront << std::endl
+       << "    - enable_ray_sorting: " << config.features.enableRaySorting << std::endl
+       << "    - heatmap: " << config.features.heatmap << std::endl
        << "  + extra_features: " << std::endl
        << "    - enable_bloom_effect: " << config.features.extra.enableBloomEffect << std::endl;
 
@@ -118,6 +140,23 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
            << "      distance_from_look_at: " << camera.distanceFromLookAt << std::endl
            << "      look_at: " << camera.lookAt << std::endl
            << "      rotation: " << camera.rotation << std::endl;
+        for (const auto& region : camera.regions)
+            os << "      region: " << region.offset.x << ", " << region.offset.y << " (" << region.size.x << " x " << region.size.y << ")" << std::endl;
+    }
+
+    os << "  + instances: " << std::endl;
+    for (const auto& instance : config.instances) {
+        os << "    - mesh: " << instance.meshIdx << std::endl
+           << "      translation: " << instance.translation << ", rotation: " << instance.rotation << ", scale: " << instance.scale << std::endl;
+    }
+
+    if (config.animation.enabled()) {
+        os << "  + animation: " << std::endl
+           << "    - frames: " << config.animation.firstFrame << " - " << config.animation.lastFrame << std::endl
+           << "    - shutter: " << config.animation.shutter << std::endl
+           << "    - camera_keyframes: " << config.animation.cameraKeyframes.size() << std::endl;
+        for (const auto& instance : config.animation.instances)
+            os << "    - instance " << instance.instanceIdx << ": " << instance.keyframes.size() << " keyframes" << std::endl;
     }
 
     os << "  + lights: " << std::endl;
@@ -190,6 +229,17 @@ std::optional<glm::ivec2> tomlArrayToIVec2(const toml::array* array)
     return output;
 }
 
+// Helper function to parse an ImageRegion from a toml::array of the form [x, y, width, height]
+std::optional<ImageRegion> tomlArrayToImageRegion(const toml::array* array)
+{
+    if (!array || array->size() != 4 || !array->is_homogeneous(toml::node_type::integer)) {
+        std::cerr << "Error: Expected an image region [x, y, width, height] of integers." << std::endl;
+        return {};
+    }
+    const auto at = [&](size_t i) { return static_cast<int>(array->get(i)->as_integer()->get()); };
+    return ImageRegion { { at(0), at(1) }, { at(2), at(3) } };
+}
+
 Config readConfigFile(const std::filesystem::path& config_path)
 {
     Config config = {};
@@ -254,6 +304,19 @@ Config readConfigFile(const std::filesystem::path& config_path)
         config.outputDir = std::filesystem::absolute(std::filesystem::path(output_dir));
     }
 
+    config.outputFormat = table["output_format"].value<std::string>().value_or("bmp");
+    std::transform(std::begin(config.outputFormat), std::end(config.outputFormat), std::begin(config.outputFormat), ::tolower);
+    if (config.outputFormat != "bmp" && config.outputFormat != "png" && config.outputFormat != "pfm" && config.outputFormat != "hdr") {
+        std::cerr << "Error: Unsupported output format \"" << config.outputFormat << "\" (expected bmp, png, pfm or hdr)." << std::endl;
+        exit(1);
+    }
+    if (const auto traceFile = table["trace_file"].value<std::string>())
+        config.traceFile = config.outputDir / *traceFile;
+    if (const auto rayDumpFile = table["ray_dump_file"].value<std::string>())
+        config.rayDumpFile = config.outputDir / *rayDumpFile;
+    if (const auto bvhReportFile = table["bvh_report_file"].value<std::string>())
+        config.bvhReportFile = config.outputDir / *bvhReportFile;
+
     config.features.enableShading = table["features"]["enable_shading"]
                                 .as_boolean()
                                 ->value_or(false);
@@ -272,6 +335,20 @@ Config readConfigFile(const std::filesystem::path& config_path)
     config.features.enableAccelStructure = table["features"]["enable_accel_structure"]
                                        .as_boolean()
                                        ->value_or(false);
+    config.features.enableLightSampling = table["features"]["enable_light_sampling"].value<bool>().value_or(false);
+    config.features.numLightSamples = table["features"]["num_light_samples"].value<int>().value_or(8);
+    config.features.maxRayDepth = table["features"]["max_ray_depth"].value<int>().value_or(5);
+    config.features.enableRussianRoulette = table["features"]["enable_russian_roulette"].value<bool>().value_or(false);
+    config.features.enableWavefront = table["features"]["enable_wavefront"].value<bool>().value_or(false);
+    config.features.enableRaySorting = table["features"]["enable_ray_sorting"].value<bool>().value_or(false);
+    std::string heatmap = table["features"]["heatmap"].value<std::string>().value_or("none");
+    std::transform(std::begin(heatmap), std::end(heatmap), std::begin(heatmap), ::tolower);
+    if (const auto it = std::find(std::begin(heatmapModeNames), std::end(heatmapModeNames), heatmap); it != std::end(heatmapModeNames)) {
+        config.features.heatmap = HeatmapMode(std::distance(std::begin(heatmapModeNames), it));
+    } else {
+        std::cerr << "Error: Unsupported heatmap \"" << heatmap << "\" (expected none, nodes, primitives or time)." << std::endl;
+        exit(1);
+    }
 
     if (table["features"]["extra"]["enable_bloom_effect"]) {
         config.features.extra.enableBloomEffect = table["features"]["extra"]["enable_bloom_effect"]
@@ -321,9 +398,83 @@ Config readConfigFile(const std::filesystem::path& config_path)
             float distanceFromLookAt = camera.at_path("distance_from_look_at").as_floating_point()->value_or(3.0f);
             glm::vec3 look_at = tomlArrayToVec3(camera.at_path("look_at").as_array()).value_or(glm::vec3(0.0f));
             glm::vec3 rotation = tomlArrayToVec3(camera.at_path("rotation").as_array()).value_or(glm::vec3(20.0f, 20.0f, 0.0f));
-            config.cameras.emplace_back(CameraConfig { fieldOfView, distanceFromLookAt, look_at, rotation });
+            // Render only part of the image: either a single crop = [x, y, width, height] or a list of tiles.
+            std::vector<ImageRegion> regions;
+            if (camera.at_path("crop")) {
+                const auto region = tomlArrayToImageRegion(camera.at_path("crop").as_array());
+                if (!region)
+                    exit(1);
+                regions.push_back(*region);
+            }
+            if (const toml::array* tiles = camera.at_path("tiles").as_array()) {
+                tiles->for_each([&](auto&& tile) {
+                    const auto region = tomlArrayToImageRegion(tile.as_array());
+                    if (!region)
+                        exit(1);
+                    regions.push_back(*region);
+                });
+            }
+            for (const ImageRegion& region : regions) {
+                const glm::ivec2 end = region.offset + region.size;
+                if (region.offset.x < 0 || region.offset.y < 0 || region.size.x <= 0 || region.size.y <= 0 || end.x > config.windowSize.x || end.y > config.windowSize.y) {
+                    std::cerr << "Error: Image region " << region.offset.x << ", " << region.offset.y << " (" << region.size.x << " x " << region.size.y
+                              << ") does not lie within the window of " << config.windowSize.x << " x " << config.windowSize.y << " pixels." << std::endl;
+                    exit(1);
+                }
+            }
+            config.cameras.emplace_back(CameraConfig { fieldOfView, distanceFromLookAt, look_at, rotation, std::move(regions) });
+        });
+    }
+
+    if (const toml::array* instances = table["instances"].as_array()) {
+        instances->for_each([&](auto&& instance) {
+            InstanceConfig instanceConfig;
+            instanceConfig.meshIdx = instance.at_path("mesh").template value<uint32_t>().value_or(0);
+            instanceConfig.translation = tomlArrayToVec3(instance.at_path("translation").as_array()).value_or(glm::vec3(0.0f));
+            instanceConfig.rotation = tomlArrayToVec3(instance.at_path("rotation").as_array()).value_or(glm::vec3(0.0f));
+            instanceConfig.scale = tomlArrayToVec3(instance.at_path("scale").as_array()).value_or(glm::vec3(1.0f));
+            config.instances.push_back(instanceConfig);
+        });
+    }
+
+    if (const toml::array* frames = table["animation"]["frames"].as_array(); frames && frames->size() == 2) {
+        config.animation.firstFrame = frames->at(0).value<int>().value_or(0);
+        config.animation.lastFrame = frames->at(1).value<int>().value_or(-1);
+    }
+    config.animation.shutter = table["animation"]["shutter"].value<float>().value_or(0.5f);
+    if (const toml::array* cameraKeyframes = table["animation"]["camera"].as_array()) {
+        cameraKeyframes->for_each([&](auto&& keyframe) {
+            CameraKeyframe cameraKeyframe;
+            cameraKeyframe.frame = keyframe.at_path("frame").template value<float>().value_or(0.0f);
+            cameraKeyframe.camera.fieldOfView = keyframe.at_path("field_of_view").template value<float>().value_or(50.0f);
+            cameraKeyframe.camera.distanceFromLookAt = keyframe.at_path("distance_from_look_at").template value<float>().value_or(3.0f);
+            cameraKeyframe.camera.lookAt = tomlArrayToVec3(keyframe.at_path("look_at").as_array()).value_or(glm::vec3(0.0f));
+            cameraKeyframe.camera.rotation = tomlArrayToVec3(keyframe.at_path("rotation").as_array()).value_or(glm::vec3(20.0f, 20.0f, 0.0f));
+            config.animation.cameraKeyframes.push_back(cameraKeyframe);
+        });
+    }
+    if (const toml::array* objects = table["animation"]["objects"].as_array()) {
+        objects->for_each([&](auto&& object) {
+            InstanceAnimationConfig instanceAnimation;
+            instanceAnimation.instanceIdx = object.at_path("instance").template value<uint32_t>().value_or(0);
+            if (const toml::array* keyframes = object.at_path("keyframes").as_array()) {
+                keyframes->for_each([&](auto&& keyframe) {
+                    TransformKeyframe transformKeyframe;
+                    transformKeyframe.frame = keyframe.at_path("frame").template value<float>().value_or(0.0f);
+                    transformKeyframe.translation = tomlArrayToVec3(keyframe.at_path("translation").as_array()).value_or(glm::vec3(0.0f));
+                    transformKeyframe.rotation = tomlArrayToVec3(keyframe.at_path("rotation").as_array()).value_or(glm::vec3(0.0f));
+                    transformKeyframe.scale = tomlArrayToVec3(keyframe.at_path("scale").as_array()).value_or(glm::vec3(1.0f));
+                    instanceAnimation.keyframes.push_back(transformKeyframe);
+                });
+            }
+            config.animation.instances.push_back(std::move(instanceAnimation));
         });
     }
+    // Interpolation expects the keyframes in order.
+    const auto byFrame = [](const auto& lhs, const auto& rhs) { return lhs.frame < rhs.frame; };
+    std::stable_sort(std::begin(config.animation.cameraKeyframes), std::end(config.animation.cameraKeyframes), byFrame);
+    for (auto& instanceAnimation : config.animation.instances)
+        std::stable_sort(std::begin(instanceAnimation.keyframes), std::end(instanceAnimation.keyframes), byFrame);
 
     const toml::array* lights = table["lights"].as_array();
     if (lights) {
@@ -373,6 +524,24 @@ Config readConfigFile(const std::filesystem::path& config_path)
     return std::move(config);
 }
 
+std::map<std::string, double> readNumberTable(const std::filesystem::path& filePath)
+{
+    std::map<std::string, double> numbers;
+    if (!std::filesystem::exists(filePath))
+        return numbers;
+    toml::parse_result result = toml::parse_file(filePath.string());
+    if (!result) {
+        std::cerr << "Failed parsing " << filePath << ":\n"
+                  << result.error() << "\n";
+        return numbers;
+    }
+    for (const auto& [key, value] : result.table()) {
+        if (const auto number = value.value<double>())
+            numbers[std::string(key.str())] = *number;
+    }
+    return numbers;
+}
+
 std::string serialize(const SceneType& sceneType)
 {
     switch (sceneType) {
@@ -7,17 +7,70 @@ DISABLE_WARNINGS_PUSH()
 DISABLE_WARNINGS_POP()
 #include <filesystem>
 #include <iosfwd>
+#include <map>
 #include <optional>
+#include <string>
 #include <utility>
 #include <variant>
 #include <vector>
 #include "common.h"
 
+// A rectangle of pixels of the image of a camera, with the origin at the top left (as in the image files).
+struct ImageRegion {
+    glm::ivec2 offset = { 0, 0 };
+    glm::ivec2 size = { 0, 0 };
+};
+
 struct CameraConfig {
     float fieldOfView = 50.0f; // in degrees
     float distanceFromLookAt = 3.0f;
     glm::vec3 lookAt = { 0.0f, 0.0f, 0.0f };
     glm::vec3 rotation = { 20.0f, 20.0f, 0.0f }; // in degrees
+    // The command-line renderer only renders these parts of the image, each to its own file (the whole image when
+    // empty). They come out exactly as in a render of the whole image.
+    std::vector<ImageRegion> regions {};
+};
+
+// A camera at a given frame of an animation; cameras between keyframes are interpolated linearly.
+struct CameraKeyframe {
+    float frame = 0.0f;
+    CameraConfig camera;
+};
+
+// Object transform (scale, then rotate, then translate) at a given frame of an animation.
+struct TransformKeyframe {
+    float frame = 0.0f;
+    glm::vec3 translation = { 0.0f, 0.0f, 0.0f };
+    glm::vec3 rotation = { 0.0f, 0.0f, 0.0f }; // in degrees
+    glm::vec3 scale = { 1.0f, 1.0f, 1.0f };
+};
+
+// Keyframes for one of the instances of the scene (see MeshInstance); the loaders create instance i for mesh i.
+struct InstanceAnimationConfig {
+    uint32_t instanceIdx = 0;
+    std::vector<TransformKeyframe> keyframes;
+};
+
+// A placement of one of the meshes of the scene. A mesh with any configured placements is only rendered at those,
+// instead of at the identity instance that the loaders give every mesh (see placeInstances).
+struct InstanceConfig {
+    uint32_t meshIdx = 0;
+    glm::vec3 translation = { 0.0f, 0.0f, 0.0f };
+    glm::vec3 rotation = { 0.0f, 0.0f, 0.0f }; // in degrees
+    glm::vec3 scale = { 1.0f, 1.0f, 1.0f };
+};
+
+// Frames firstFrame..lastFrame (inclusive) are rendered when lastFrame >= firstFrame. The keyframed camera path is
+// rendered in addition to the static cameras; instances without keyframes keep the transform they were loaded with.
+struct AnimationConfig {
+    int firstFrame = 0;
+    int lastFrame = -1;
+    // Fraction of a frame that the shutter stays open for, when motion blur is enabled.
+    float shutter = 0.5f;
+    std::vector<CameraKeyframe> cameraKeyframes;
+    std::vector<InstanceAnimationConfig> instances;
+
+    [[nodiscard]] bool enabled() const { return lastFrame >= firstFrame; }
 };
 
 struct Config {
@@ -28,7 +81,18 @@ struct Config {
     std::filesystem::path dataPath = DATA_DIR;
     std::variant<SceneType, std::filesystem::path> scene = SceneType::SingleTriangle;
     std::filesystem::path outputDir = "";
+    std::string outputFormat = "bmp"; // One of bmp, png (16 bits per channel), pfm or hdr.
+    // Timeline of the run in Chrome trace JSON (see trace_events.h); relative to outputDir. Not recorded when empty.
+    std::filesystem::path traceFile = "";
+    // Every ray traced by the command-line renderer and its hit (see ray_recorder.h); relative to outputDir. Not
+    // recorded when empty.
+    std::filesystem::path rayDumpFile = "";
+    // Quality report of the BVH as JSON (see bvh_quality.h), written by the command-line renderer once the BVH is
+    // built; relative to outputDir. Not written when empty.
+    std::filesystem::path bvhReportFile = "";
     std::vector<CameraConfig> cameras;
+    std::vector<InstanceConfig> instances;
+    AnimationConfig animation;
     std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>> lights;
 };
 
@@ -36,5 +100,9 @@ std::ostream& operator<<(std::ostream& arg, const Config& config);
 
 Config readConfigFile(const std::filesystem::path& config_path);
 
+// Read a TOML file of `name = number` pairs, such as the time budgets of the regression check (see src/regression.cpp).
+// Entries that are not numbers are skipped; a missing or malformed file gives an empty map.
+std::map<std::string, double> readNumberTable(const std::filesystem::path& filePath);
+
 std::string serialize(const SceneType& sceneType);
 std::optional<SceneType> deserialize(const std::string& lowered);
\ No newline at end of file
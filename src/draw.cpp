@@ -169,8 +169,12 @@ void drawAABB(const AxisAlignedBox& box, DrawMode drawMode, const glm::vec3& col
 
 void drawScene(const Scene& scene)
 {
-    for (const auto& mesh : scene.meshes)
-        drawMesh(mesh);
+    for (const auto& instance : scene.instances) {
+        glPushMatrix();
+        glMultMatrixf(glm::value_ptr(instance.transform));
+        drawMesh(scene.meshes[instance.meshIdx]);
+        glPopMatrix();
+    }
     for (const auto& sphere : scene.spheres)
         drawSphere(sphere);
 }
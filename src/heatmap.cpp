@@ -0,0 +1,100 @@
+#include "heatmap.h"
+#include "common.h"
+#include "light.h"
+#include "ray_statistics.h"
+#include "render.h"
+#include "sampler.h"
+#include "screen.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <chrono>
+#include <framework/trackball.h>
+#include <vector>
+#ifdef NDEBUG
+#include <omp.h>
+#endif
+
+// Fraction of the pixels whose cost is below the top of the colormap.
+static constexpr float heatmapNormalizationPercentile = 0.99f;
+
+void renderHeatmap(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, int frame, const std::optional<RenderRegion>& region)
+{
+    using clock = std::chrono::steady_clock;
+
+    const glm::ivec2 windowResolution = screen.resolution();
+    const RenderRegion imageRegion = region.value_or(RenderRegion { windowResolution });
+    std::vector<float> costs(size_t(windowResolution.x) * size_t(windowResolution.y), 0.0f);
+    resetShadowOccluderCache();
+#ifdef NDEBUG
+#pragma omp parallel for schedule(guided)
+#endif
+    for (int y = 0; y < windowResolution.y; y++) {
+        for (int x = 0; x != windowResolution.x; x++) {
+            const glm::ivec2 imagePixel = imageRegion.offset + glm::ivec2(x, y);
+            const glm::vec2 normalizedPixelPos {
+                float(imagePixel.x) / float(imageRegion.imageResolution.x) * 2.0f - 1.0f,
+                float(imagePixel.y) / float(imageRegion.imageResolution.y) * 2.0f - 1.0f
+            };
+            // Same camera ray and random numbers as renderRayTracing, so that the cost is that of the normal render.
+            const auto start = clock::now();
+            Ray cameraRay = camera.generateRay(normalizedPixelPos);
+            Sampler sampler { pixelSeed(imagePixel.x, imagePixel.y, frame) };
+            if (features.extra.enableMotionBlur)
+                cameraRay.time = sampler.next1D();
+            takeThreadTraversalCost();
+            getFinalColor(scene, bvh, cameraRay, features, sampler);
+            const TraversalCost cost = takeThreadTraversalCost();
+            const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+            float& pixelCost = costs[size_t(y) * size_t(windowResolution.x) + size_t(x)];
+            switch (features.heatmap) {
+            case HeatmapMode::NodesVisited: {
+                pixelCost = float(cost.nodesVisited);
+            } break;
+            case HeatmapMode::PrimitivesTested: {
+                pixelCost = float(cost.primitivesTested);
+            } break;
+            case HeatmapMode::Time: {
+                pixelCost = float(nanoseconds);
+            } break;
+            case HeatmapMode::None: {
+            } break;
+            }
+        }
+    }
+
+    std::vector<float> sortedCosts = costs;
+    const auto percentile = std::begin(sortedCosts) + ptrdiff_t(heatmapNormalizationPercentile * float(sortedCosts.size() - 1));
+    std::nth_element(std::begin(sortedCosts), percentile, std::end(sortedCosts));
+    const float maxCost = std::max(*percentile, 1.0f);
+    for (int y = 0; y < windowResolution.y; y++) {
+        for (int x = 0; x != windowResolution.x; x++)
+            screen.setPixel(x, y, heatmapColor(costs[size_t(y) * size_t(windowResolution.x) + size_t(x)] / maxCost));
+    }
+}
+
+// Polynomial approximation of Turbo by Anton Mikhailov (Google, 2019), accurate to within a few 8-bit levels.
+glm::vec3 heatmapColor(float value)
+{
+    constexpr glm::vec4 red4 { 0.13572138f, 4.61539260f, -42.66032258f, 132.13108234f };
+    constexpr glm::vec4 green4 { 0.09140261f, 2.19418839f, 4.84296658f, -14.18503333f };
+    constexpr glm::vec4 blue4 { 0.10667330f, 12.64194608f, -60.58204836f, 110.36276771f };
+    constexpr glm::vec2 red2 { -152.94239396f, 59.28637943f };
+    constexpr glm::vec2 green2 { 4.27729857f, 2.82956604f };
+    constexpr glm::vec2 blue2 { -89.90310912f, 27.34824973f };
+
+    const float x = std::clamp(value, 0.0f, 1.0f);
+    const glm::vec4 v4 { 1.0f, x, x * x, x * x * x };
+    const glm::vec2 v2 = glm::vec2(v4.z, v4.w) * v4.z;
+    return glm::clamp(glm::vec3 {
+                          glm::dot(v4, red4) + glm::dot(v2, red2),
+                          glm::dot(v4, green4) + glm::dot(v2, green2),
+                          glm::dot(v4, blue4) + glm::dot(v2, blue2) },
+        0.0f, 1.0f);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "render.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <optional>
+
+// Forward declarations.
+struct Scene;
+class Screen;
+class Trackball;
+class BvhInterface;
+struct Features;
+
+// Alternative to renderRayTracing that shows where the render time goes: every pixel is traced as usual, but
+// instead of its colour the screen receives its cost as selected by features.heatmap; the BVH nodes visited or
+// the primitives tested by all rays of the pixel (camera, shadow and reflection rays), or the wall-clock time
+// that the pixel took. Always uses the depth-first renderer, since the wavefront renderer does not trace pixels
+// one at a time.
+//
+// The costs are scaled so that the 99th percentile maps to the top of the colormap; a handful of pathological
+// pixels would otherwise push everything else to the bottom. Pixels above it are clamped. When only a region of the
+// image is rendered, the percentile is that of the region.
+void renderHeatmap(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, int frame = 0, const std::optional<RenderRegion>& region = {});
+
+// Map a value in [0, 1] to the Turbo colormap: dark blue for low values, through green and yellow, to dark red.
+glm::vec3 heatmapColor(float value);
@@ -0,0 +1,79 @@
+#include "image_writer.h"
+#include "trace_events.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/core.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <system_error>
+
+ImageWriter::ImageWriter(size_t maxInFlight, size_t numThreads)
+    : m_maxInFlight(std::max(maxInFlight, size_t(1)))
+{
+    for (size_t i = 0; i < std::max(numThreads, size_t(1)); i++)
+        m_threads.emplace_back([this]() { run(); });
+}
+
+ImageWriter::~ImageWriter()
+{
+    {
+        std::lock_guard lock { m_mutex };
+        m_stop = true;
+    }
+    m_jobAvailable.notify_all();
+    // The threads only exit once the queue is empty.
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+void ImageWriter::enqueue(Screen screen, std::filesystem::path filePath)
+{
+    {
+        TraceScope traceScope { "enqueue image" }; // Includes waiting for room in the queue.
+        std::unique_lock lock { m_mutex };
+        m_jobFinished.wait(lock, [&]() { return m_inFlight < m_maxInFlight; });
+        m_inFlight++;
+        m_jobs.push_back(Job { std::move(screen), std::move(filePath), std::chrono::high_resolution_clock::now() });
+    }
+    m_jobAvailable.notify_one();
+}
+
+void ImageWriter::wait()
+{
+    std::unique_lock lock { m_mutex };
+    m_jobFinished.wait(lock, [&]() { return m_inFlight == 0; });
+}
+
+void ImageWriter::run()
+{
+    using clock = std::chrono::high_resolution_clock;
+    setTraceThreadName("image writer");
+    while (true) {
+        std::unique_lock lock { m_mutex };
+        m_jobAvailable.wait(lock, [&]() { return m_stop || !m_jobs.empty(); });
+        if (m_jobs.empty())
+            return; // m_stop was set and there is nothing left to write.
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+
+        const auto start = clock::now();
+        {
+            TraceScope traceScope { "write " + job.filePath.filename().string() };
+            job.screen.writeImageToFile(job.filePath);
+        }
+        const auto end = clock::now();
+        std::error_code error;
+        const auto fileSize = std::filesystem::file_size(job.filePath, error);
+        fmt::print("Image saved to {} ({:.1f} MiB): queued {:.1f} ms, encode + write {:.1f} ms\n",
+            job.filePath.string(), error ? 0.0 : double(fileSize) / (1024.0 * 1024.0),
+            std::chrono::duration<double, std::milli>(start - job.enqueueTime).count(),
+            std::chrono::duration<double, std::milli>(end - start).count());
+
+        lock.lock();
+        m_inFlight--;
+        lock.unlock();
+        m_jobFinished.notify_all();
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "screen.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Writes rendered images to disk on background threads so that rendering the next image overlaps with
+// encoding and writing the previous ones. At most maxInFlight images are queued or being written at any time;
+// enqueue() blocks until there is room, which bounds the memory held by finished frame buffers.
+class ImageWriter {
+public:
+    explicit ImageWriter(size_t maxInFlight, size_t numThreads = 1);
+    // Waits for all queued images to be written.
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    // Hand over a finished image; the format is picked from the file extension (see Screen::writeImageToFile).
+    void enqueue(Screen screen, std::filesystem::path filePath);
+    // Block until every image enqueued so far has been written.
+    void wait();
+
+private:
+    struct Job {
+        Screen screen;
+        std::filesystem::path filePath;
+        std::chrono::high_resolution_clock::time_point enqueueTime;
+    };
+
+    void run();
+
+    const size_t m_maxInFlight;
+    std::mutex m_mutex;
+    std::condition_variable m_jobAvailable;
+    std::condition_variable m_jobFinished;
+    std::deque<Job> m_jobs;
+    size_t m_inFlight { 0 };
+    bool m_stop { false };
+    std::vector<std::thread> m_threads;
+};
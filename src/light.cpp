@@ -1,64 +1,244 @@
 #include "light.h"
+#include "bounding_volume_hierarchy.h"
 #include "config.h"
+#include "ray_recorder.h"
+#include "ray_statistics.h"
+#include <framework/variant_helper.h>
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/geometric.hpp>
 DISABLE_WARNINGS_POP()
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <variant>
+#include <vector>
 
 
+// the same as sampleSegmentLight below, on the members of a segment light (as stored in scene.lightArrays)
+static void sampleSegmentLight(const glm::vec3& endpoint0, const glm::vec3& endpoint1, const glm::vec3& color0, const glm::vec3& color1, Sampler& sampler, glm::vec3& position, glm::vec3& color)
+{
+    const float u = sampler.next1D();
+    position = glm::mix(endpoint0, endpoint1, u);
+    color = glm::mix(color0, color1, u);
+}
+
+// the same as sampleParallelogramLight below, on the members of a parallelogram light (as stored in scene.lightArrays)
+static void sampleParallelogramLight(const glm::vec3& v0, const glm::vec3& edge01, const glm::vec3& edge02,
+    const glm::vec3& color0, const glm::vec3& color1, const glm::vec3& color2, const glm::vec3& color3, Sampler& sampler, glm::vec3& position, glm::vec3& color)
+{
+    const glm::vec2 uv = sampler.next2D();
+    position = v0 + uv.x * edge01 + uv.y * edge02;
+    // color0 is at v0, color1 at v0 + edge01, color2 at v0 + edge02 and color3 at the opposite corner.
+    color = glm::mix(glm::mix(color0, color1, uv.x), glm::mix(color2, color3, uv.x), uv.y);
+}
+
 // samples a segment light source
-// you should fill in the vectors position and color with the sampled position and color
-void sampleSegmentLight(const SegmentLight& segmentLight, glm::vec3& position, glm::vec3& color)
+// fills in the vectors position and color with the sampled position and (linearly interpolated) color
+// the random number is drawn from sampler so that consecutive samples are stratified along the segment
+void sampleSegmentLight(const SegmentLight& segmentLight, Sampler& sampler, glm::vec3& position, glm::vec3& color)
 {
-    position = glm::vec3(0.0);
-    color = glm::vec3(0.0);
-    // TODO: implement this function.
+    sampleSegmentLight(segmentLight.endpoint0, segmentLight.endpoint1, segmentLight.color0, segmentLight.color1, sampler, position, color);
 }
 
 // samples a parallelogram light source
-// you should fill in the vectors position and color with the sampled position and color
-void sampleParallelogramLight(const ParallelogramLight& parallelogramLight, glm::vec3& position, glm::vec3& color)
+// fills in the vectors position and color with the sampled position and (bilinearly interpolated) color
+// the random numbers are drawn from sampler so that consecutive samples are stratified over the parallelogram
+void sampleParallelogramLight(const ParallelogramLight& parallelogramLight, Sampler& sampler, glm::vec3& position, glm::vec3& color)
 {
-    position = glm::vec3(0.0);
-    color = glm::vec3(0.0);
-    // TODO: implement this function.
+    sampleParallelogramLight(parallelogramLight.v0, parallelogramLight.edge01, parallelogramLight.edge02,
+        parallelogramLight.color0, parallelogramLight.color1, parallelogramLight.color2, parallelogramLight.color3, sampler, position, color);
+}
+
+// Offset applied to the origin of shadow rays to prevent self intersection.
+static constexpr float shadowRayEpsilon = 1e-4f;
+
+// computes the shadow ray from the intersection point towards samplePos
+// returns false if the light sample lies behind the surface, as seen from the incoming ray
+bool computeShadowRay(const glm::vec3& samplePos, const Ray& ray, const HitInfo& hitInfo, Ray& shadowRay)
+{
+    const glm::vec3 hitPoint = ray.origin + ray.t * ray.direction;
+    const glm::vec3 toLight = samplePos - hitPoint;
+    const float distance = glm::length(toLight);
+    const float cosLight = glm::dot(hitInfo.normal, toLight);
+    const float cosView = glm::dot(hitInfo.normal, -ray.direction);
+    if (distance <= shadowRayEpsilon || (cosLight > 0.0f) != (cosView > 0.0f))
+        return false;
+
+    // Move the origin away from the surface, on the side of the light.
+    const glm::vec3 offset = (cosLight > 0.0f ? shadowRayEpsilon : -shadowRayEpsilon) * hitInfo.normal;
+    shadowRay.origin = hitPoint + offset;
+    shadowRay.direction = toLight / distance;
+    shadowRay.t = distance - shadowRayEpsilon;
+    shadowRay.time = ray.time;
+    return true;
 }
 
 // test the visibility at a given light sample
 // returns 1.0 if sample is visible, 0.0 otherwise
 float testVisibilityLightSample(const glm::vec3& samplePos, const glm::vec3& debugColor, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo)
 {
-    // TODO: implement this function.
-    return 1.0;
-}
+    Ray shadowRay;
+    if (!computeShadowRay(samplePos, ray, hitInfo, shadowRay))
+        return 0.0f;
+    countRays(RayType::Shadow);
+    setTracedRayType(RayType::Shadow);
 
-// given an intersection, computes the contribution from all light sources at the intersection point
-// in this method you should cycle the light sources and for each one compute their contribution
-// don't forget to check for visibility (shadows!)
+    HitInfo shadowHitInfo;
+    if (bvh.intersect(shadowRay, shadowHitInfo, features)) {
+        // Draw occluded shadow rays in red.
+        drawRay(shadowRay, glm::vec3(1.0f, 0.0f, 0.0f));
+        return 0.0f;
+    }
+    drawRay(shadowRay, debugColor);
+    return 1.0f;
+}
 
-// Lights are stored in a single array (scene.lights) where each item can be either a PointLight, SegmentLight or ParallelogramLight.
-// You can check whether a light at index i is a PointLight using std::holds_alternative:
-// std::holds_alternative<PointLight>(scene.lights[i])
+// The primitive that most recently blocked a shadow ray towards each light (indexed like scene.lights), per thread.
+// Neighbouring pixels usually have their shadow rays blocked by the same primitive, so testing that one first
+// skips the BVH traversal for most occluded shadow rays. Every thread clears its cache when it sees that the
+// generation changed (see resetShadowOccluderCache).
 //
-// If it is indeed a point light, you can "convert" it to the correct type using std::get:
-// PointLight pointLight = std::get<PointLight>(scene.lights[i]);
+// Stale entries are harmless: a cached primitive from an edited or reloaded scene is still a primitive of the
+// current scene (or out of range and skipped), and any hit before the light is a genuine occlusion.
+struct ShadowOccluderCache {
+    uint64_t generation = 0;
+    std::vector<PrimitiveRef> lastOccluders;
+};
+static std::atomic<uint64_t> shadowOccluderCacheGeneration { 1 };
+static thread_local ShadowOccluderCache shadowOccluderCache;
+
+void resetShadowOccluderCache()
+{
+    shadowOccluderCacheGeneration.fetch_add(1, std::memory_order_relaxed);
+}
+
+// same as testVisibilityLightSample, but traces an occlusion query that first tests the last occluder of light lightIdx
+static float testVisibilityLightSampleCached(const Scene& scene, uint32_t lightIdx, const glm::vec3& samplePos, const glm::vec3& debugColor, const BvhInterface& bvh, const Features& features, const Ray& ray, const HitInfo& hitInfo)
+{
+    // the occlusion query is only available on the hierarchy itself, which bvh wraps (see BoundingVolumeHierarchy::ofScene)
+    const BoundingVolumeHierarchy* pBvh = BoundingVolumeHierarchy::ofScene(scene);
+    if (!pBvh)
+        return testVisibilityLightSample(samplePos, debugColor, bvh, features, ray, hitInfo);
+
+    Ray shadowRay;
+    if (!computeShadowRay(samplePos, ray, hitInfo, shadowRay))
+        return 0.0f;
+    countRays(RayType::Shadow);
+    setTracedRayType(RayType::Shadow);
+
+    ShadowOccluderCache& cache = shadowOccluderCache;
+    if (const uint64_t generation = shadowOccluderCacheGeneration.load(std::memory_order_relaxed); cache.generation != generation) {
+        cache.generation = generation;
+        cache.lastOccluders.clear();
+    }
+    if (cache.lastOccluders.size() <= lightIdx)
+        cache.lastOccluders.resize(scene.lights.size() > lightIdx ? scene.lights.size() : lightIdx + 1);
+
+    if (pBvh->occluded(shadowRay, features, cache.lastOccluders[lightIdx])) {
+        drawRay(shadowRay, glm::vec3(1.0f, 0.0f, 0.0f));
+        return 0.0f;
+    }
+    drawRay(shadowRay, debugColor);
+    return 1.0f;
+}
+
+// Number of samples taken on a segment or parallelogram light per shading point.
+static constexpr int numAreaLightSamples = 16;
+
+// Calls visit(lightIdx, position, color, weight, testVisibility) for every light sample used to shade an
+// intersection; lightIdx is the index of the light in scene.lights. The contribution of a sample is
+// weight * visibility * computeShading(position, color, ...), where visibility is only tested if testVisibility is set.
+// This is shared by computeLightContribution (depth first) and generateLightSamples (wavefront renderer).
+template <typename F>
+static void forEachLightSample(const Scene& scene, const Features& features, Sampler& sampler, F&& visit)
+{
+    // Calls sampleLight(lightSampler, position, color) for each of the samples on a segment or parallelogram light.
+    const auto visitAreaLight = [&](uint32_t lightIdx, float weight, auto&& sampleLight) {
+        // The samples on the light form their own sequence so that they are stratified against each other.
+        const uint32_t lightSeed = sampler.nextSeed();
+        for (int i = 0; i < numAreaLightSamples; i++) {
+            Sampler lightSampler { lightSeed, uint32_t(i) };
+            glm::vec3 position, color;
+            sampleLight(lightSampler, position, color);
+            visit(lightIdx, position, color, weight / float(numAreaLightSamples), features.enableSoftShadow);
+        }
+    };
+    const auto visitSegmentLight = [&](uint32_t lightIdx, const SegmentLight& segmentLight, float weight) {
+        visitAreaLight(lightIdx, weight, [&](Sampler& lightSampler, glm::vec3& position, glm::vec3& color) {
+            sampleSegmentLight(segmentLight, lightSampler, position, color);
+        });
+    };
+    const auto visitParallelogramLight = [&](uint32_t lightIdx, const ParallelogramLight& parallelogramLight, float weight) {
+        visitAreaLight(lightIdx, weight, [&](Sampler& lightSampler, glm::vec3& position, glm::vec3& color) {
+            sampleParallelogramLight(parallelogramLight, lightSampler, position, color);
+        });
+    };
+    const auto visitLight = [&](uint32_t lightIdx, float weight) {
+        std::visit(
+            make_visitor(
+                [&](const PointLight& pointLight) { visit(lightIdx, pointLight.position, pointLight.color, weight, features.enableHardShadow); },
+                [&](const SegmentLight& segmentLight) { visitSegmentLight(lightIdx, segmentLight, weight); },
+                [&](const ParallelogramLight& parallelogramLight) { visitParallelogramLight(lightIdx, parallelogramLight, weight); }),
+            scene.lights[lightIdx]);
+    };
+
+    // The light sampler is only valid if it was rebuilt (see updateLights()) after the last change to scene.lights.
+    const bool useLightSampling = features.enableLightSampling && features.numLightSamples > 0
+        && scene.lightSampler.size() == scene.lights.size() && scene.lights.size() > size_t(features.numLightSamples);
+    if (useLightSampling) {
+        for (int i = 0; i < features.numLightSamples; i++) {
+            float pdf;
+            const size_t lightIdx = scene.lightSampler.sample(sampler.next1D(), pdf);
+            if (pdf > 0.0f)
+                visitLight(uint32_t(lightIdx), 1.0f / (pdf * float(features.numLightSamples)));
+        }
+        return;
+    }
+
+    const LightArrays& lightArrays = scene.lightArrays;
+    if (lightArrays.pointIndices.size() + lightArrays.segmentIndices.size() + lightArrays.parallelogramIndices.size() != scene.lights.size()) {
+        // The light arrays are out of date (see updateLights()); fall back to the lights themselves.
+        for (size_t lightIdx = 0; lightIdx < scene.lights.size(); lightIdx++)
+            visitLight(uint32_t(lightIdx), 1.0f);
+        return;
+    }
+
+    for (size_t i = 0; i < lightArrays.pointIndices.size(); i++)
+        visit(lightArrays.pointIndices[i], lightArrays.pointPositions[i], lightArrays.pointColors[i], 1.0f, features.enableHardShadow);
+    for (size_t i = 0; i < lightArrays.segmentIndices.size(); i++) {
+        visitAreaLight(lightArrays.segmentIndices[i], 1.0f, [&](Sampler& lightSampler, glm::vec3& position, glm::vec3& color) {
+            sampleSegmentLight(lightArrays.segmentEndpoints0[i], lightArrays.segmentEndpoints1[i],
+                lightArrays.segmentColors0[i], lightArrays.segmentColors1[i], lightSampler, position, color);
+        });
+    }
+    for (size_t i = 0; i < lightArrays.parallelogramIndices.size(); i++) {
+        visitAreaLight(lightArrays.parallelogramIndices[i], 1.0f, [&](Sampler& lightSampler, glm::vec3& position, glm::vec3& color) {
+            sampleParallelogramLight(lightArrays.parallelogramOrigins[i], lightArrays.parallelogramEdges01[i], lightArrays.parallelogramEdges02[i],
+                lightArrays.parallelogramColors0[i], lightArrays.parallelogramColors1[i], lightArrays.parallelogramColors2[i], lightArrays.parallelogramColors3[i],
+                lightSampler, position, color);
+        });
+    }
+}
+
+void generateLightSamples(const Scene& scene, const Features& features, Sampler& sampler, std::vector<LightSample>& samples)
+{
+    forEachLightSample(scene, features, sampler, [&](uint32_t lightIdx, const glm::vec3& position, const glm::vec3& color, float weight, bool testVisibility) {
+        samples.push_back(LightSample { position, color, weight, lightIdx, testVisibility });
+    });
+}
+
+// given an intersection, computes the contribution from all light sources at the intersection point
+// the light sources are cycled and for each one their contribution is computed, including visibility (shadows!)
 //
+// Lights are stored in a single array (scene.lights) where each item can be either a PointLight, SegmentLight or ParallelogramLight.
+// The same lights are also partitioned by type in scene.lightArrays, which is what the loop over all lights (forEachLightSample) uses.
 //
-// The code to iterate over the lights thus looks like this:
-// for (const auto& light : scene.lights) {
-//     if (std::holds_alternative<PointLight>(light)) {
-//         const PointLight pointLight = std::get<PointLight>(light);
-//         // Perform your calculations for a point light.
-//     } else if (std::holds_alternative<SegmentLight>(light)) {
-//         const SegmentLight segmentLight = std::get<SegmentLight>(light);
-//         // Perform your calculations for a segment light.
-//     } else if (std::holds_alternative<ParallelogramLight>(light)) {
-//         const ParallelogramLight parallelogramLight = std::get<ParallelogramLight>(light);
-//         // Perform your calculations for a parallelogram light.
-//     }
-// }
+// With many lights in the scene, looping over all of them for every shading point becomes the bottleneck.
+// When features.enableLightSampling is set, features.numLightSamples lights are instead drawn from scene.lightSampler
+// (proportional to their power) and each contribution is divided by the probability of drawing that light. This gives
+// an unbiased estimate of the sum over all lights at a fixed cost per shading point.
 //
 // Regarding the soft shadows for **other** light sources **extra** feature:
 // To add a new light source, define your new light struct in scene.h and modify the Scene struct (also in scene.h)
@@ -67,13 +247,17 @@ float testVisibilityLightSample(const glm::vec3& samplePos, const glm::vec3& deb
 //
 // You can add the light sources programmatically by creating a custom scene (modify the Custom case in the
 // loadScene function in scene.cpp). Custom lights will not be visible in rasterization view.
-glm::vec3 computeLightContribution(const Scene& scene, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo)
+glm::vec3 computeLightContribution(const Scene& scene, const BvhInterface& bvh, const Features& features, Sampler& sampler, Ray ray, HitInfo hitInfo)
 {
     if (features.enableShading) {
         // If shading is enabled, compute the contribution from all lights.
-
-        // TODO: replace this by your own implementation of shading
-        return hitInfo.material.kd;
+        glm::vec3 Lo { 0.0f };
+        forEachLightSample(scene, features, sampler, [&](uint32_t lightIdx, const glm::vec3& position, const glm::vec3& color, float weight, bool testVisibility) {
+            const float visibility = testVisibility ? testVisibilityLightSampleCached(scene, lightIdx, position, color, bvh, features, ray, hitInfo) : 1.0f;
+            if (visibility > 0.0f)
+                Lo += weight * visibility * computeShading(position, color, features, ray, hitInfo);
+        });
+        return Lo;
 
     } else {
         // If shading is disabled, return the albedo of the material.
@@ -3,14 +3,41 @@
 #include "config.h"
 #include "draw.h"
 #include "intersect.h"
+#include "sampler.h"
 #include "scene.h"
 #include "shading.h"
+#include <cstdint>
+#include <vector>
 
-void sampleSegmentLight (const SegmentLight& segmentLight, glm::vec3& position, glm::vec3& color);
+void sampleSegmentLight (const SegmentLight& segmentLight, Sampler& sampler, glm::vec3& position, glm::vec3& color);
 
-void sampleParallelogramLight (const ParallelogramLight& parallelogramLight, glm::vec3& position, glm::vec3& color);
+void sampleParallelogramLight (const ParallelogramLight& parallelogramLight, Sampler& sampler, glm::vec3& position, glm::vec3& color);
 
 float testVisibilityLightSample(const glm::vec3& samplePos, const glm::vec3& debugColor, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo);
 
-glm::vec3 computeLightContribution(const Scene& scene, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo);
+// Compute the shadow ray from the intersection point (ray.t along ray) towards samplePos.
+// Returns false if the sample lies behind the surface as seen from the incoming ray (in which case it is never visible).
+bool computeShadowRay(const glm::vec3& samplePos, const Ray& ray, const HitInfo& hitInfo, Ray& shadowRay);
+
+// A sample on one of the lights, as used to shade an intersection point. Its contribution is
+// weight * visibility * computeShading(position, color, ...); visibility only needs to be tested if testVisibility is set.
+struct LightSample {
+    glm::vec3 position;
+    glm::vec3 color;
+    float weight;
+    uint32_t lightIdx;
+    bool testVisibility;
+};
+
+// Append the light samples that computeLightContribution would use to shade an intersection point, without
+// tracing any shadow rays. Used by the wavefront renderer to trace the shadow rays of many hits in one batch.
+void generateLightSamples(const Scene& scene, const Features& features, Sampler& sampler, std::vector<LightSample>& samples);
+
+glm::vec3 computeLightContribution(const Scene& scene, const BvhInterface& bvh, const Features& features, Sampler& sampler, Ray ray, HitInfo hitInfo);
+
+// Forget the primitives that last blocked a shadow ray, on every thread. Renderers call this once per frame. A cached
+// occluder is tested with the same arithmetic as the BVH, but the BVH only tests it if the ray hits the boxes around
+// it, which a ray that grazes a box may not in the last bit; which pixels share a cache can then (very rarely)
+// change a pixel.
+void resetShadowOccluderCache();
 
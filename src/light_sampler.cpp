@@ -0,0 +1,90 @@
+#include "light_sampler.h"
+#include <framework/variant_helper.h>
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <numeric>
+
+static float luminance(const glm::vec3& color)
+{
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Area lights are averaged over their samples in computeLightContribution, so their power is the average of their colors.
+static float lightPower(const std::variant<PointLight, SegmentLight, ParallelogramLight>& light)
+{
+    return std::visit(
+        make_visitor(
+            [](const PointLight& pointLight) { return luminance(pointLight.color); },
+            [](const SegmentLight& segmentLight) { return 0.5f * luminance(segmentLight.color0 + segmentLight.color1); },
+            [](const ParallelogramLight& parallelogramLight) {
+                return 0.25f * luminance(parallelogramLight.color0 + parallelogramLight.color1 + parallelogramLight.color2 + parallelogramLight.color3);
+            }),
+        light);
+}
+
+LightSampler::LightSampler(const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights)
+    : m_pmf(lights.size())
+    , m_acceptance(lights.size(), 1.0f)
+    , m_aliases(lights.size())
+{
+    const size_t numLights = lights.size();
+    if (numLights == 0)
+        return;
+
+    std::transform(std::begin(lights), std::end(lights), std::begin(m_pmf), [](const auto& light) { return std::max(lightPower(light), 0.0f); });
+    const float totalPower = std::accumulate(std::begin(m_pmf), std::end(m_pmf), 0.0f);
+    if (totalPower > 0.0f) {
+        for (float& p : m_pmf)
+            p /= totalPower;
+    } else {
+        // All lights are black; fall back to uniform selection.
+        std::fill(std::begin(m_pmf), std::end(m_pmf), 1.0f / float(numLights));
+    }
+
+    // Vose's alias method: split the lights into bins that are under- and over-full relative to the average
+    // and let every under-full bin borrow the remainder of its probability from an over-full one.
+    std::vector<float> scaled(numLights);
+    std::vector<uint32_t> small, large;
+    for (uint32_t i = 0; i < numLights; i++) {
+        scaled[i] = m_pmf[i] * float(numLights);
+        m_aliases[i] = i;
+        (scaled[i] < 1.0f ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        const uint32_t s = small.back();
+        small.pop_back();
+        const uint32_t l = large.back();
+
+        m_acceptance[s] = scaled[s];
+        m_aliases[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0f;
+        if (scaled[l] < 1.0f) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Any bins left over are (up to rounding errors) exactly full and keep m_acceptance = 1.
+}
+
+size_t LightSampler::size() const
+{
+    return m_pmf.size();
+}
+
+size_t LightSampler::sample(float u, float& pdf) const
+{
+    const float scaled = u * float(m_pmf.size());
+    const size_t bin = std::min(size_t(scaled), m_pmf.size() - 1);
+    const size_t lightIdx = (scaled - float(bin)) < m_acceptance[bin] ? bin : m_aliases[bin];
+    pdf = m_pmf[lightIdx];
+    return lightIdx;
+}
+
+float LightSampler::pdf(size_t lightIdx) const
+{
+    return m_pmf[lightIdx];
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "common.h"
+#include <cstdint>
+#include <variant>
+#include <vector>
+
+// Alias table (Walker/Vose) over the lights of a scene. Lights are drawn with a probability proportional
+// to their emitted power, in constant time regardless of the number of lights in the scene.
+class LightSampler {
+public:
+    LightSampler() = default;
+    explicit LightSampler(const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights);
+
+    // Number of lights that the table was built for.
+    [[nodiscard]] size_t size() const;
+
+    // Draw a light index given a uniform random number u in [0, 1).
+    // pdf receives the probability with which the returned light was selected.
+    size_t sample(float u, float& pdf) const;
+
+    // Probability with which the light at lightIdx is selected by sample().
+    [[nodiscard]] float pdf(size_t lightIdx) const;
+
+private:
+    std::vector<float> m_pmf;
+    std::vector<float> m_acceptance;
+    std::vector<uint32_t> m_aliases;
+};
@@ -1,8 +1,15 @@
+#include "animation.h"
+#include "bounding_volume_hierarchy.h"
 #include "config.h"
 #include "draw.h"
+#include "image_writer.h"
 #include "light.h"
+#include "ray_recorder.h"
+#include "ray_statistics.h"
 #include "render.h"
+#include "sampler.h"
 #include "screen.h"
+#include "trace_events.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
@@ -15,6 +22,8 @@ DISABLE_WARNINGS_PUSH()
 #include <imgui/imgui.h>
 #include <nativefiledialog/nfd.h>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cfloat>
 #include <chrono>
 #include <cstdlib>
 #include <filesystem>
@@ -22,6 +31,7 @@ DISABLE_WARNINGS_POP()
 #include <framework/trackball.h>
 #include <framework/variant_helper.h>
 #include <framework/window.h>
+#include <fstream>
 #include <iostream>
 #include <optional>
 #include <random>
@@ -44,6 +54,7 @@ bool sliderIntSquarePower(const char* label, int* v, int v_min, int v_max);
 
 int main(int argc, char** argv)
 {
+    const auto configStart = TraceClock::now();
     Config config = {};
     if (argc > 1) {
         config = readConfigFile(argv[1]);
@@ -72,6 +83,10 @@ int main(int argc, char** argv)
         bool debugBVHLevel { false };
         bool debugBVHLeaf { false };
         ViewMode viewMode { ViewMode::Rasterization };
+        // Counted during the most recent render (only with ENABLE_RAY_STATISTICS).
+        RayStatistics rayStatistics;
+        // Computed when the BVH quality node is first opened after the BVH was built.
+        std::optional<BvhQualityReport> optBvhQualityReport;
 
         window.registerKeyCallback([&](int key, int /* scancode */, int action, int /* mods */) {
             if (action == GLFW_PRESS) {
@@ -119,6 +134,7 @@ int main(int argc, char** argv)
                     scene = loadScenePrebuilt(sceneType, config.dataPath);
                     selectedLightIdx = scene.lights.empty() ? -1 : 0;
                     bvh = BvhInterface(&scene);
+                    optBvhQualityReport.reset();
                     if (optDebugRay) {
                         HitInfo dummy {};
                         bvh.intersect(*optDebugRay, dummy, config.features);
@@ -134,11 +150,25 @@ int main(int argc, char** argv)
             if (ImGui::CollapsingHeader("Features", ImGuiTreeNodeFlags_DefaultOpen)) {
                 ImGui::Checkbox("Shading", &config.features.enableShading);
                 ImGui::Checkbox("Recursive(reflections)", &config.features.enableRecursive);
+                if (config.features.enableRecursive) {
+                    ImGui::SliderInt("Max ray depth", &config.features.maxRayDepth, 1, 32);
+                    ImGui::Checkbox("Russian roulette", &config.features.enableRussianRoulette);
+                }
                 ImGui::Checkbox("Hard shadows", &config.features.enableHardShadow);
                 ImGui::Checkbox("Soft shadows", &config.features.enableSoftShadow);
                 ImGui::Checkbox("BVH", &config.features.enableAccelStructure);
                 ImGui::Checkbox("Texture mapping", &config.features.enableTextureMapping);
                 ImGui::Checkbox("Normal interpolation", &config.features.enableNormalInterp);
+                ImGui::Checkbox("Light importance sampling", &config.features.enableLightSampling);
+                if (config.features.enableLightSampling)
+                    ImGui::SliderInt("Lights per shading point", &config.features.numLightSamples, 1, 64);
+                ImGui::Checkbox("Wavefront renderer", &config.features.enableWavefront);
+                if (config.features.enableWavefront)
+                    ImGui::Checkbox("Sort secondary rays", &config.features.enableRaySorting);
+                {
+                    constexpr std::array items { "None", "BVH nodes visited", "Primitives tested", "Time (ns)" };
+                    ImGui::Combo("Heatmap", reinterpret_cast<int*>(&config.features.heatmap), items.data(), int(items.size()));
+                }
             }
             ImGui::Separator();
 
@@ -171,11 +201,13 @@ int main(int argc, char** argv)
             if (ImGui::Button("Render to file")) {
                 // Show a file picker.
                 nfdchar_t* pOutPath = nullptr;
-                const nfdresult_t result = NFD_SaveDialog("bmp", nullptr, &pOutPath);
+                const nfdresult_t result = NFD_SaveDialog("bmp;png;pfm;hdr", nullptr, &pOutPath);
                 if (result == NFD_OKAY) {
                     std::filesystem::path outPath { pOutPath };
                     free(pOutPath); // NFD is a C API so we have to manually free the memory it allocated.
-                    outPath.replace_extension("bmp"); // Make sure that the file extension is *.bmp
+                    // Make sure that the file extension is one that Screen can write, defaulting to *.bmp.
+                    if (const auto extension = outPath.extension(); extension != ".png" && extension != ".pfm" && extension != ".hdr")
+                        outPath.replace_extension("bmp");
 
                     // Perform a new render and measure the time it took to generate the image.
                     using clock = std::chrono::high_resolution_clock;
@@ -183,8 +215,12 @@ int main(int argc, char** argv)
                     renderRayTracing(scene, camera, bvh, screen, config.features);
                     const auto end = clock::now();
                     std::cout << "Time to render image: " << std::chrono::duration<float, std::milli>(end - start).count() << " milliseconds" << std::endl;
+                    if constexpr (rayStatisticsEnabled) {
+                        rayStatistics = collectRayStatistics();
+                        std::cout << rayStatistics;
+                    }
                     // Store the new image.
-                    screen.writeBitmapToFile(outPath);
+                    screen.writeImageToFile(outPath);
                 }
             }
 
@@ -199,10 +235,52 @@ int main(int argc, char** argv)
                 if (debugBVHLeaf)
                     ImGui::SliderInt("BVH Leaf", &bvhDebugLeaf, 1, bvh.numLeaves());
             }
+            if (rayStatisticsEnabled && ImGui::TreeNode("Ray statistics (last render)")) {
+                ImGui::Text("Camera rays: %llu", static_cast<unsigned long long>(rayStatistics.cameraRays));
+                ImGui::Text("Shadow rays: %llu", static_cast<unsigned long long>(rayStatistics.shadowRays));
+                ImGui::Text("Reflection rays: %llu", static_cast<unsigned long long>(rayStatistics.reflectionRays));
+                ImGui::Text("Refraction rays: %llu", static_cast<unsigned long long>(rayStatistics.refractionRays));
+                ImGui::Text("Hits per ray: %.3f", rayStatistics.hitsPerRay());
+                ImGui::Text("BVH nodes per ray: %.2f", rayStatistics.nodesPerRay());
+                ImGui::Text("Primitives tested per ray: %.2f", rayStatistics.primitivesPerRay());
+                ImGui::TreePop();
+            }
+            if (ImGui::TreeNode("BVH quality")) {
+                if (!optBvhQualityReport) {
+                    if (const BoundingVolumeHierarchy* pBvh = BoundingVolumeHierarchy::ofScene(scene))
+                        optBvhQualityReport = pBvh->qualityReport();
+                    else
+                        optBvhQualityReport.emplace();
+                }
+                const BvhQualityReport& report = *optBvhQualityReport;
+                ImGui::Text("Top level: SAH cost %.2f, sibling overlap %.3f", double(report.topLevel.sahCost), double(report.topLevel.siblingOverlap));
+                ImGui::Text("Top level: %u nodes, %u leaves", report.topLevel.numNodes, report.topLevel.numLeaves);
+                uint32_t numMeshNodes = 0, numMeshLeaves = 0;
+                float meshSahCost = 0.0f, meshSiblingOverlap = 0.0f;
+                for (const BvhTreeQuality& meshQuality : report.meshes) {
+                    numMeshNodes += meshQuality.numNodes;
+                    numMeshLeaves += meshQuality.numLeaves;
+                    meshSahCost = std::max(meshSahCost, meshQuality.sahCost);
+                    meshSiblingOverlap = std::max(meshSiblingOverlap, meshQuality.siblingOverlap);
+                }
+                ImGui::Text("Meshes: %zu trees, %u nodes, %u leaves", report.meshes.size(), numMeshNodes, numMeshLeaves);
+                ImGui::Text("Meshes: max SAH cost %.2f, max sibling overlap %.3f", double(meshSahCost), double(meshSiblingOverlap));
+                ImGui::Text("Memory: %.2f MiB", double(report.memoryBytes) / (1024.0 * 1024.0));
+                const auto plotHistogram = [](const char* label, const std::vector<uint32_t>& histogram) {
+                    std::vector<float> values(std::begin(histogram), std::end(histogram));
+                    ImGui::PlotHistogram(label, values.data(), int(values.size()), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+                };
+                plotHistogram("Mesh leaf sizes", report.meshLeafSizes);
+                plotHistogram("Mesh leaf depths", report.meshLeafDepths);
+                if (ImGui::Button("Recompute"))
+                    optBvhQualityReport.reset();
+                ImGui::TreePop();
+            }
 
             ImGui::Spacing();
             ImGui::Separator();
             ImGui::Text("Lights");
+            bool lightsChanged = false;
             {
                 std::vector<std::string> options;
                 options.push_back("None");
@@ -217,29 +295,35 @@ int main(int argc, char** argv)
                 ImGui::Combo("Selected light", &selectedLightIdx, optionsPointers.data(), static_cast<int>(optionsPointers.size()));
                 --selectedLightIdx;
 
+                // Moves with the 3D controls do not go through ImGui, so they are detected by comparing the position.
+                const auto moveWithGizmo = [&](glm::vec3& position) {
+                    const glm::vec3 previousPosition = position;
+                    showImGuizmoTranslation(window, camera, position);
+                    lightsChanged |= position != previousPosition;
+                };
                 if (selectedLightIdx >= 0) {
                     setOpenGLMatrices(camera);
                     std::visit(
                         make_visitor(
                             [&](PointLight& light) {
-                                showImGuizmoTranslation(window, camera, light.position); // 3D controls to translate light source.
-                                ImGui::DragFloat3("Light position", glm::value_ptr(light.position), 0.01f, -3.0f, 3.0f);
-                                ImGui::ColorEdit3("Light color", glm::value_ptr(light.color));
+                                moveWithGizmo(light.position); // 3D controls to translate light source.
+                                lightsChanged |= ImGui::DragFloat3("Light position", glm::value_ptr(light.position), 0.01f, -3.0f, 3.0f);
+                                lightsChanged |= ImGui::ColorEdit3("Light color", glm::value_ptr(light.color));
                             },
                             [&](SegmentLight& light) {
                                 static int selectedEndpoint = 0;
                                 // 3D controls to translate light source.
                                 if (selectedEndpoint == 0)
-                                    showImGuizmoTranslation(window, camera, light.endpoint0);
+                                    moveWithGizmo(light.endpoint0);
                                 else
-                                    showImGuizmoTranslation(window, camera, light.endpoint1);
+                                    moveWithGizmo(light.endpoint1);
 
                                 const std::array<const char*, 2> endpointOptions { "Endpoint 0", "Endpoint 1" };
                                 ImGui::Combo("Selected endpoint", &selectedEndpoint, endpointOptions.data(), int(endpointOptions.size()));
-                                ImGui::DragFloat3("Endpoint 0", glm::value_ptr(light.endpoint0), 0.01f, -3.0f, 3.0f);
-                                ImGui::DragFloat3("Endpoint 1", glm::value_ptr(light.endpoint1), 0.01f, -3.0f, 3.0f);
-                                ImGui::ColorEdit3("Color 0", glm::value_ptr(light.color0));
-                                ImGui::ColorEdit3("Color 1", glm::value_ptr(light.color1));
+                                lightsChanged |= ImGui::DragFloat3("Endpoint 0", glm::value_ptr(light.endpoint0), 0.01f, -3.0f, 3.0f);
+                                lightsChanged |= ImGui::DragFloat3("Endpoint 1", glm::value_ptr(light.endpoint1), 0.01f, -3.0f, 3.0f);
+                                lightsChanged |= ImGui::ColorEdit3("Color 0", glm::value_ptr(light.color0));
+                                lightsChanged |= ImGui::ColorEdit3("Color 1", glm::value_ptr(light.color1));
                             },
                             [&](ParallelogramLight& light) {
                                 glm::vec3 vertex1 = light.v0 + light.edge01;
@@ -247,25 +331,29 @@ int main(int argc, char** argv)
 
                                 static int selectedVertex = 0;
                                 // 3D controls to translate light source.
+                                const bool changedBefore = lightsChanged;
                                 if (selectedVertex == 0)
-                                    showImGuizmoTranslation(window, camera, light.v0);
+                                    moveWithGizmo(light.v0);
                                 else if (selectedVertex == 1)
-                                    showImGuizmoTranslation(window, camera, vertex1);
+                                    moveWithGizmo(vertex1);
                                 else
-                                    showImGuizmoTranslation(window, camera, vertex2);
+                                    moveWithGizmo(vertex2);
 
                                 const std::array<const char*, 3> vertexOptions { "Vertex 0", "Vertex 1", "Vertex 2" };
                                 ImGui::Combo("Selected vertex", &selectedVertex, vertexOptions.data(), int(vertexOptions.size()));
-                                ImGui::DragFloat3("Vertex 0", glm::value_ptr(light.v0), 0.01f, -3.0f, 3.0f);
-                                ImGui::DragFloat3("Vertex 1", glm::value_ptr(vertex1), 0.01f, -3.0f, 3.0f);
-                                light.edge01 = vertex1 - light.v0;
-                                ImGui::DragFloat3("Vertex 2", glm::value_ptr(vertex2), 0.01f, -3.0f, 3.0f);
-                                light.edge02 = vertex2 - light.v0;
-
-                                ImGui::ColorEdit3("Color 0", glm::value_ptr(light.color0));
-                                ImGui::ColorEdit3("Color 1", glm::value_ptr(light.color1));
-                                ImGui::ColorEdit3("Color 2", glm::value_ptr(light.color2));
-                                ImGui::ColorEdit3("Color 3", glm::value_ptr(light.color3));
+                                lightsChanged |= ImGui::DragFloat3("Vertex 0", glm::value_ptr(light.v0), 0.01f, -3.0f, 3.0f);
+                                lightsChanged |= ImGui::DragFloat3("Vertex 1", glm::value_ptr(vertex1), 0.01f, -3.0f, 3.0f);
+                                lightsChanged |= ImGui::DragFloat3("Vertex 2", glm::value_ptr(vertex2), 0.01f, -3.0f, 3.0f);
+                                // Only recompute the edges when a vertex moved: going through the vertices rounds them.
+                                if (lightsChanged && !changedBefore) {
+                                    light.edge01 = vertex1 - light.v0;
+                                    light.edge02 = vertex2 - light.v0;
+                                }
+
+                                lightsChanged |= ImGui::ColorEdit3("Color 0", glm::value_ptr(light.color0));
+                                lightsChanged |= ImGui::ColorEdit3("Color 1", glm::value_ptr(light.color1));
+                                lightsChanged |= ImGui::ColorEdit3("Color 2", glm::value_ptr(light.color2));
+                                lightsChanged |= ImGui::ColorEdit3("Color 3", glm::value_ptr(light.color3));
                             },
                             [](auto) { /* any other type of light */ }),
                         scene.lights[size_t(selectedLightIdx)]);
@@ -273,14 +361,17 @@ int main(int argc, char** argv)
             }
 
             if (ImGui::Button("Add point light")) {
+                lightsChanged = true;
                 selectedLightIdx = int(scene.lights.size());
                 scene.lights.emplace_back(PointLight { .position = glm::vec3(0.0f), .color = glm::vec3(1.0f) });
             }
             if (ImGui::Button("Add segment light")) {
+                lightsChanged = true;
                 selectedLightIdx = int(scene.lights.size());
                 scene.lights.emplace_back(SegmentLight { .endpoint0 = glm::vec3(0.0f), .endpoint1 = glm::vec3(1.0f), .color0 = glm::vec3(1, 0, 0), .color1 = glm::vec3(0, 0, 1) });
             }
             if (ImGui::Button("Add parallelogram light")) {
+                lightsChanged = true;
                 selectedLightIdx = int(scene.lights.size());
                 scene.lights.emplace_back(ParallelogramLight {
                     .v0 = glm::vec3(0.0f),
@@ -295,7 +386,11 @@ int main(int argc, char** argv)
             if (selectedLightIdx >= 0 && ImGui::Button("Remove selected light")) {
                 scene.lights.erase(std::begin(scene.lights) + selectedLightIdx);
                 selectedLightIdx = -1;
+                lightsChanged = true;
             }
+            // Loading a scene updates its lights already.
+            if (lightsChanged)
+                updateLights(scene);
 
             // Clear screen.
             glViewport(0, 0, window.getFrameBufferSize().x, window.getFrameBufferSize().y);
@@ -324,7 +419,8 @@ int main(int argc, char** argv)
                     enableDebugDraw = true;
                     glDisable(GL_LIGHTING);
                     glDepthFunc(GL_LEQUAL);
-                    (void)getFinalColor(scene, bvh, *optDebugRay, config.features);
+                    Sampler sampler { 0 };
+                    (void)getFinalColor(scene, bvh, *optDebugRay, config.features, sampler);
                     enableDebugDraw = false;
                 }
                 glPopAttrib();
@@ -353,6 +449,7 @@ int main(int argc, char** argv)
             case ViewMode::RayTracing: {
                 screen.clear(glm::vec3(0.0f));
                 renderRayTracing(scene, camera, bvh, screen, config.features);
+                rayStatistics = collectRayStatistics();
                 screen.setPixel(0, 0, glm::vec3(1.0f));
                 screen.draw(); // Takes the image generated using ray tracing and outputs it to the screen using OpenGL.
             } break;
@@ -366,6 +463,11 @@ int main(int argc, char** argv)
     } else {
         // Command-line rendering.
         std::cout << config;
+        if (!config.traceFile.empty()) {
+            startTraceRecording();
+            setTraceThreadName("main");
+            addTraceEvent("read config", configStart, TraceClock::now());
+        }
         // NOTE(Yang): Trackball is highly coupled with the window,
         // so we need to create a dummy window here but not show it.
         // In this case, GLEW will not be initialized, OpenGL functions
@@ -387,6 +489,8 @@ int main(int argc, char** argv)
                        }),
             config.scene);
 
+        placeInstances(scene, config.instances);
+
         BvhInterface bvh { &scene };
 
         using clock = std::chrono::high_resolution_clock;
@@ -394,32 +498,114 @@ int main(int argc, char** argv)
         if (!std::filesystem::exists(config.outputDir)) {
             std::filesystem::create_directories(config.outputDir);
         }
+        if (!config.bvhReportFile.empty()) {
+            if (const BoundingVolumeHierarchy* pBvh = BoundingVolumeHierarchy::ofScene(scene)) {
+                std::ofstream file { config.bvhReportFile };
+                writeBvhQualityReportJson(file, pBvh->qualityReport());
+                fmt::print("BVH quality report written to {}\n", config.bvhReportFile.string());
+            } else {
+                std::cerr << "No BVH of the scene to report on; " << config.bvhReportFile << " is not written" << std::endl;
+            }
+        }
+        if (!config.rayDumpFile.empty() && !startRayRecording(config.rayDumpFile))
+            std::cerr << "Could not create the ray dump " << config.rayDumpFile << std::endl;
         const auto start = clock::now();
         std::string start_time_string = fmt::format("{:%Y-%m-%d-%H:%M:%S}", fmt::localtime(std::time(nullptr)));
 
-        std::vector<std::thread> workers;
+        // Encoding and writing the images is handed to a background thread so that it overlaps with rendering.
+        // Every camera thread holds on to its frame buffer until the writer has room for it.
+        const size_t maxImagesInFlight = std::max(std::thread::hardware_concurrency() / 2u, 2u);
+        ImageWriter imageWriter { maxImagesInFlight };
+
+        // In animation mode every camera is rendered for every frame. The scene and BVH are loaded once;
+        // frames only move the animated instances and update the BVH when something actually moved.
+        const int firstFrame = config.animation.enabled() ? config.animation.firstFrame : 0;
+        const int lastFrame = config.animation.enabled() ? config.animation.lastFrame : 0;
+        SceneAnimator animator { scene, config.animation };
+        size_t numImages = 0;
+        for (int frame = firstFrame; frame <= lastFrame; frame++) {
+            const float shutter = config.features.extra.enableMotionBlur ? config.animation.shutter : 0.0f;
+            if (config.animation.enabled() && animator.setFrame(scene, float(frame), shutter)) {
+                const auto updateStart = clock::now();
+                if (BoundingVolumeHierarchy* pBvh = BoundingVolumeHierarchy::ofScene(scene)) {
+                    pBvh->update();
+                } else {
+                    std::cerr << "Frame " << frame << ": no BVH of the scene to update; building a new one" << std::endl;
+                    bvh = BvhInterface(&scene);
+                }
+                fmt::print("Frame {}: BVH updated in {:.2f} ms\n", frame, std::chrono::duration<float, std::milli>(clock::now() - updateStart).count());
+            }
 
-        for (int i = 0; auto const& cameraConfig : config.cameras) {
-            workers.emplace_back(std::thread([&](int index) {
-                Screen screen { config.windowSize, false };
-                screen.clear(glm::vec3(0.0f));
-                Trackball camera { &window, glm::radians(cameraConfig.fieldOfView), cameraConfig.distanceFromLookAt };
-                camera.setCamera(cameraConfig.lookAt, glm::radians(cameraConfig.rotation), cameraConfig.distanceFromLookAt);
-                renderRayTracing(scene, camera, bvh, screen, config.features);
-                const auto filename_base = fmt::format("{}_{}_cam_{}", sceneName, start_time_string, index);
-                const auto filepath = config.outputDir / (filename_base + ".bmp");
-                fmt::print("Image {} saved to {}\n", index, filepath.string());
-                screen.writeBitmapToFile(filepath);
-            },
-                i));
-            ++i;
+            std::vector<CameraConfig> cameras = config.cameras;
+            if (!config.animation.cameraKeyframes.empty())
+                cameras.push_back(interpolateCamera(config.animation.cameraKeyframes, float(frame)));
+
+            TraceScope frameScope { fmt::format("frame {}", frame) };
+            std::vector<std::thread> workers;
+            for (int i = 0; auto const& cameraConfig : cameras) {
+                workers.emplace_back(std::thread([&](int index) {
+                    setTraceThreadName(fmt::format("camera {} (frame {})", index, frame));
+                    TraceScope cameraScope { fmt::format("render camera {}", index) };
+                    Trackball camera { &window, glm::radians(cameraConfig.fieldOfView), cameraConfig.distanceFromLookAt };
+                    camera.setCamera(cameraConfig.lookAt, glm::radians(cameraConfig.rotation), cameraConfig.distanceFromLookAt);
+                    const auto camera_filename_base = config.animation.enabled()
+                        ? fmt::format("{}_{}_cam_{}_frame_{:04}", sceneName, start_time_string, index, frame)
+                        : fmt::format("{}_{}_cam_{}", sceneName, start_time_string, index);
+
+                    // Either the whole image, or every crop / tile of the camera into an image of its own.
+                    std::vector<std::optional<ImageRegion>> regions { std::begin(cameraConfig.regions), std::end(cameraConfig.regions) };
+                    if (regions.empty())
+                        regions.emplace_back();
+                    for (const auto& region : regions) {
+                        Screen screen { region ? region->size : config.windowSize, false };
+                        screen.clear(glm::vec3(0.0f));
+                        std::optional<RenderRegion> renderRegion;
+                        std::string filename_base = camera_filename_base;
+                        if (region) {
+                            // Image regions count rows from the top, the screen from the bottom.
+                            renderRegion = RenderRegion { config.windowSize, { region->offset.x, config.windowSize.y - region->offset.y - region->size.y } };
+                            filename_base += fmt::format("_crop_{}_{}_{}x{}", region->offset.x, region->offset.y, region->size.x, region->size.y);
+                        }
+                        const auto renderStart = clock::now();
+                        renderRayTracing(scene, camera, bvh, screen, config.features, frame, renderRegion);
+                        const auto renderEnd = clock::now();
+                        const auto filepath = config.outputDir / (filename_base + "." + config.outputFormat);
+                        fmt::print("Image {} rendered in {} ms\n", filename_base, std::chrono::duration_cast<std::chrono::milliseconds>(renderEnd - renderStart).count());
+                        imageWriter.enqueue(std::move(screen), filepath);
+                    }
+                },
+                    i));
+                ++i;
+            }
+            // The scene is only modified between frames, once every camera has finished rendering it.
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            if constexpr (rayStatisticsEnabled) {
+                // The cameras are rendered concurrently, so the counters are reported for all of them together.
+                fmt::print("Frame {}: ", frame);
+                std::cout << collectRayStatistics();
+            }
+            for (const auto& cameraConfig : cameras)
+                numImages += std::max(cameraConfig.regions.size(), size_t(1));
         }
-        for (auto& worker : workers) {
-            worker.join();
+        {
+            TraceScope traceScope { "wait for image writer" };
+            imageWriter.wait();
         }
         const auto end = clock::now();
         const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-        fmt::print("Rendering took {} ms, {} images rendered.\n", duration, config.cameras.size());
+        fmt::print("Rendering took {} ms, {} images rendered.\n", duration, numImages);
+        if (rayRecordingEnabled()) {
+            const uint64_t numRays = stopRayRecording();
+            fmt::print("{} rays written to {}\n", numRays, config.rayDumpFile.string());
+        }
+        if (!config.traceFile.empty()) {
+            if (writeTraceEvents(config.traceFile))
+                fmt::print("Trace written to {}\n", config.traceFile.string());
+            else
+                std::cerr << "Could not write the trace to " << config.traceFile << std::endl;
+        }
     }
 
     return 0;
@@ -0,0 +1,261 @@
+#include "bvh_interface.h"
+#include "config.h"
+#include "draw.h"
+#include "interpolate.h"
+#include "intersect.h"
+#include "scene.h"
+#include "sphere_batch.h"
+#include "texture.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/reporters/catch_reporter_event_listener.hpp>
+#include <catch2/reporters/catch_reporter_registrars.hpp>
+#include <fmt/core.h>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <framework/image.h>
+#include <framework/trackball.h>
+#include <framework/window.h>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Micro-benchmarks of the intersection kernels and of BVH traversal (run FinalProjectMicroBenchmark; pass
+// "[bvh]", "[intersect]" or "[texture]" to select a group). Every benchmark measures a single operation: one ray
+// against one primitive (or one batch of spheres), or one ray through the BVH. Catch2 reports the time per operation,
+// and the listener below ends the run with a table of ns/op and millions of operations (rays or lookups) per second.
+//
+// The kernels are fed from a ray set that is recorded once through the camera of the renderer: the camera rays of
+// a 256x256 image of the Monkey scene, and the mirror reflections at their hits as a set of incoherent rays.
+// Primitive tests pair every ray with the triangle that it hit (or bounding volumes around it), so that they
+// measure hits rather than early-out misses. The sphere batch benchmark tests sphereBatchWidth spheres per
+// operation, so its table entry counts batches rather than rays.
+
+namespace {
+
+struct RecordedHit {
+    Ray ray; // With t reset to infinity.
+    std::array<glm::vec3, 3> vertices; // Of the triangle that was hit, in world space like the ray.
+    glm::vec3 position;
+};
+
+struct RaySet {
+    Scene scene;
+    std::vector<Ray> cameraRays;
+    std::vector<Ray> reflectionRays;
+    std::vector<RecordedHit> hits;
+    std::vector<Sphere> hitSpheres; // Bounding sphere of the triangle of every hit.
+    std::vector<AxisAlignedBox> hitBoxes; // Bounding box of the triangle of every hit.
+    SphereBatch sphereBatch; // Same spheres as hitSpheres.
+};
+
+constexpr glm::ivec2 recordResolution { 256, 256 };
+
+Ray resetRay(Ray ray)
+{
+    ray.t = std::numeric_limits<float>::max();
+    return ray;
+}
+
+// Vertices of the triangle of a hit, moved into world space by the transform of the instance that was hit.
+std::array<glm::vec3, 3> triangleVertices(const Scene& scene, const HitInfo& hitInfo)
+{
+    const Mesh& mesh = scene.meshes[hitInfo.primitive.meshIdx];
+    const glm::mat4& transform = scene.instances[hitInfo.primitive.instanceIdx].transform;
+    const glm::uvec3& tri = mesh.triangles[hitInfo.primitive.primitiveIdx];
+    std::array<glm::vec3, 3> vertices;
+    for (size_t i = 0; i < vertices.size(); i++)
+        vertices[i] = glm::vec3(transform * glm::vec4(mesh.vertices[tri[glm::length_t(i)]].position, 1.0f));
+    return vertices;
+}
+
+RaySet& raySet()
+{
+    static RaySet recorded = [] {
+        RaySet set;
+        set.scene = loadScenePrebuilt(SceneType::Monkey, Config {}.dataPath);
+
+        // Trackball needs a window; like the command-line renderer, create one that is never shown.
+        enableDebugDraw = false;
+        Window window { "Final Project Micro Benchmark", recordResolution, OpenGLVersion::GL2, false };
+        const CameraConfig cameraConfig {};
+        Trackball camera { &window, glm::radians(cameraConfig.fieldOfView), cameraConfig.distanceFromLookAt };
+        camera.setCamera(cameraConfig.lookAt, glm::radians(cameraConfig.rotation), cameraConfig.distanceFromLookAt);
+
+        BvhInterface bvh { &set.scene };
+        Features features {};
+        features.enableAccelStructure = true;
+        for (int y = 0; y < recordResolution.y; y++) {
+            for (int x = 0; x < recordResolution.x; x++) {
+                const glm::vec2 normalizedPixelPos {
+                    float(x) / float(recordResolution.x) * 2.0f - 1.0f,
+                    float(y) / float(recordResolution.y) * 2.0f - 1.0f
+                };
+                Ray ray = camera.generateRay(normalizedPixelPos);
+                set.cameraRays.push_back(ray);
+                HitInfo hitInfo;
+                if (!bvh.intersect(ray, hitInfo, features) || hitInfo.primitive.type != PrimitiveType::Triangle)
+                    continue;
+
+                const glm::vec3 position = ray.origin + ray.t * ray.direction;
+                set.hits.push_back(RecordedHit { resetRay(ray), triangleVertices(set.scene, hitInfo), position });
+
+                const glm::vec3 normal = glm::dot(hitInfo.normal, ray.direction) < 0.0f ? hitInfo.normal : -hitInfo.normal;
+                set.reflectionRays.push_back(Ray { position + 1e-4f * normal, glm::reflect(ray.direction, normal) });
+            }
+        }
+
+        for (const RecordedHit& hit : set.hits) {
+            const auto [v0, v1, v2] = hit.vertices;
+            const glm::vec3 centroid = (v0 + v1 + v2) / 3.0f;
+            const float radius = std::sqrt(std::max({ glm::dot(v0 - centroid, v0 - centroid), glm::dot(v1 - centroid, v1 - centroid), glm::dot(v2 - centroid, v2 - centroid) }));
+            set.hitSpheres.push_back(Sphere { centroid, radius, Material {} });
+            set.hitBoxes.push_back(AxisAlignedBox { glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)) });
+        }
+        std::vector<uint32_t> sphereIndices(set.hitSpheres.size());
+        std::iota(std::begin(sphereIndices), std::end(sphereIndices), 0u);
+        set.sphereBatch = makeSphereBatch(set.hitSpheres, sphereIndices);
+        return set;
+    }();
+    return recorded;
+}
+
+// Prints the mean time per operation of every benchmark, and the corresponding throughput, after all have run.
+class ThroughputListener : public Catch::EventListenerBase {
+public:
+    using Catch::EventListenerBase::EventListenerBase;
+
+    void benchmarkEnded(Catch::BenchmarkStats<> const& benchmarkStats) override
+    {
+        m_results.emplace_back(benchmarkStats.info.name, benchmarkStats.mean.point.count());
+    }
+
+    void testRunEnded(Catch::TestRunStats const&) override
+    {
+        if (m_results.empty())
+            return;
+        fmt::print("\n{:<48} {:>12} {:>12}\n", "benchmark", "ns/op", "Mops/s");
+        for (const auto& [name, nanosecondsPerOperation] : m_results)
+            fmt::print("{:<48} {:>12.2f} {:>12.2f}\n", name, nanosecondsPerOperation, 1e3 / nanosecondsPerOperation);
+    }
+
+private:
+    std::vector<std::pair<std::string, double>> m_results;
+};
+
+}
+
+CATCH_REGISTER_LISTENER(ThroughputListener)
+
+TEST_CASE("Ray-primitive intersection", "[intersect]")
+{
+    const RaySet& set = raySet();
+    REQUIRE(!set.hits.empty());
+    const size_t numHits = set.hits.size();
+
+    BENCHMARK_ADVANCED("intersectRayWithTriangle")(Catch::Benchmark::Chronometer meter)
+    {
+        meter.measure([&](int i) {
+            const RecordedHit& hit = set.hits[size_t(i) % numHits];
+            const auto& [v0, v1, v2] = hit.vertices;
+            Ray ray = hit.ray;
+            HitInfo hitInfo;
+            return intersectRayWithTriangle(v0, v1, v2, ray, hitInfo);
+        });
+    };
+
+    BENCHMARK_ADVANCED("intersectRayWithShape (sphere)")(Catch::Benchmark::Chronometer meter)
+    {
+        meter.measure([&](int i) {
+            const size_t hitIdx = size_t(i) % numHits;
+            Ray ray = set.hits[hitIdx].ray;
+            HitInfo hitInfo;
+            return intersectRayWithShape(set.hitSpheres[hitIdx], ray, hitInfo);
+        });
+    };
+
+    BENCHMARK_ADVANCED("intersectRayWithSpheres (per batch of 8)")(Catch::Benchmark::Chronometer meter)
+    {
+        const uint32_t numBatches = uint32_t(numHits / sphereBatchWidth);
+        meter.measure([&](int i) {
+            const uint32_t begin = (uint32_t(i) % std::max(numBatches, 1u)) * sphereBatchWidth;
+            Ray ray = set.hits[begin].ray;
+            return intersectRayWithSpheres(set.sphereBatch, begin, std::min(begin + sphereBatchWidth, uint32_t(numHits)), ray);
+        });
+    };
+
+    BENCHMARK_ADVANCED("intersectRayWithShape (AABB)")(Catch::Benchmark::Chronometer meter)
+    {
+        meter.measure([&](int i) {
+            const size_t hitIdx = size_t(i) % numHits;
+            Ray ray = set.hits[hitIdx].ray;
+            return intersectRayWithShape(set.hitBoxes[hitIdx], ray);
+        });
+    };
+
+    BENCHMARK_ADVANCED("computeBarycentricCoord")(Catch::Benchmark::Chronometer meter)
+    {
+        meter.measure([&](int i) {
+            const RecordedHit& hit = set.hits[size_t(i) % numHits];
+            const auto& [v0, v1, v2] = hit.vertices;
+            return computeBarycentricCoord(v0, v1, v2, hit.position);
+        });
+    };
+}
+
+TEST_CASE("Texture lookup", "[texture]")
+{
+    const Image image { Config {}.dataPath / "default.png" };
+    // Texture coordinates spread over the whole image (a low-discrepancy R2 sequence).
+    std::vector<glm::vec2> texCoords(4096);
+    for (size_t i = 0; i < texCoords.size(); i++)
+        texCoords[i] = glm::fract(glm::vec2(0.5f) + float(i) * glm::vec2(0.7548776662f, 0.5698402910f));
+
+    Features nearest {};
+    nearest.enableTextureMapping = true;
+    Features bilinear = nearest;
+    bilinear.extra.enableBilinearTextureFiltering = true;
+
+    BENCHMARK_ADVANCED("acquireTexel (nearest)")(Catch::Benchmark::Chronometer meter)
+    {
+        meter.measure([&](int i) { return acquireTexel(image, texCoords[size_t(i) % texCoords.size()], nearest); });
+    };
+
+    BENCHMARK_ADVANCED("acquireTexel (bilinear)")(Catch::Benchmark::Chronometer meter)
+    {
+        meter.measure([&](int i) { return acquireTexel(image, texCoords[size_t(i) % texCoords.size()], bilinear); });
+    };
+}
+
+TEST_CASE("BVH traversal", "[bvh]")
+{
+    RaySet& set = raySet();
+    BvhInterface bvh { &set.scene };
+    Features features {};
+    features.enableAccelStructure = true;
+
+    BENCHMARK_ADVANCED("BvhInterface::intersect (camera rays)")(Catch::Benchmark::Chronometer meter)
+    {
+        meter.measure([&](int i) {
+            Ray ray = set.cameraRays[size_t(i) % set.cameraRays.size()];
+            HitInfo hitInfo;
+            return bvh.intersect(ray, hitInfo, features);
+        });
+    };
+
+    BENCHMARK_ADVANCED("BvhInterface::intersect (reflection rays)")(Catch::Benchmark::Chronometer meter)
+    {
+        meter.measure([&](int i) {
+            Ray ray = set.reflectionRays[size_t(i) % set.reflectionRays.size()];
+            HitInfo hitInfo;
+            return bvh.intersect(ray, hitInfo, features);
+        });
+    };
+}
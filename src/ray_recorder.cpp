@@ -0,0 +1,144 @@
+#include "ray_recorder.h"
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+// A thread appends its rays to the file once this many are buffered.
+constexpr size_t rayBufferFlushSize = 1 << 16;
+
+// The buffered rays of one thread. Only the owning thread appends to it; the lock is for stopRayRecording, which
+// flushes the buffers of (thread pool) threads that are still alive.
+struct ThreadRayBuffer {
+    std::mutex mutex;
+    std::vector<RecordedRay> rays;
+};
+
+struct RayRecording {
+    std::atomic<bool> enabled { false };
+    std::mutex mutex; // Protects everything below.
+    std::ofstream file;
+    uint64_t numRaysWritten = 0;
+    // Owns the buffers of every thread that recorded rays, including threads that have exited since.
+    std::vector<std::unique_ptr<ThreadRayBuffer>> buffers;
+};
+
+RayRecording& rayRecording()
+{
+    static RayRecording recording;
+    return recording;
+}
+
+ThreadRayBuffer& threadRayBuffer()
+{
+    static thread_local ThreadRayBuffer* pBuffer = [] {
+        RayRecording& recording = rayRecording();
+        std::scoped_lock lock { recording.mutex };
+        recording.buffers.push_back(std::make_unique<ThreadRayBuffer>());
+        return recording.buffers.back().get();
+    }();
+    return *pBuffer;
+}
+
+thread_local RayType tracedRayType = RayType::Camera;
+
+// Append the rays to the file and clear them; the caller holds recording.mutex.
+void writeRays(RayRecording& recording, std::vector<RecordedRay>& rays)
+{
+    if (recording.file.is_open()) {
+        recording.file.write(reinterpret_cast<const char*>(rays.data()), std::streamsize(rays.size() * sizeof(RecordedRay)));
+        recording.numRaysWritten += rays.size();
+    }
+    rays.clear();
+}
+
+}
+
+bool startRayRecording(const std::filesystem::path& filePath)
+{
+    RayRecording& recording = rayRecording();
+    std::scoped_lock lock { recording.mutex };
+    recording.file.open(filePath, std::ios::binary | std::ios::trunc);
+    if (!recording.file)
+        return false;
+    const RayDumpHeader header {};
+    recording.file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    recording.numRaysWritten = 0;
+    // Drop rays that were traced after a previous recording stopped.
+    for (const auto& pBuffer : recording.buffers) {
+        std::scoped_lock bufferLock { pBuffer->mutex };
+        pBuffer->rays.clear();
+    }
+    recording.enabled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+uint64_t stopRayRecording()
+{
+    RayRecording& recording = rayRecording();
+    recording.enabled.store(false, std::memory_order_relaxed);
+    std::scoped_lock lock { recording.mutex };
+    for (const auto& pBuffer : recording.buffers) {
+        std::scoped_lock bufferLock { pBuffer->mutex };
+        writeRays(recording, pBuffer->rays);
+    }
+    recording.file.close();
+    return recording.numRaysWritten;
+}
+
+bool rayRecordingEnabled()
+{
+    return rayRecording().enabled.load(std::memory_order_relaxed);
+}
+
+void setTracedRayType(RayType type)
+{
+    tracedRayType = type;
+}
+
+void recordTracedRay(const Ray& ray, float tMax, bool hit, const HitInfo& hitInfo, RayQuery query)
+{
+    ThreadRayBuffer& buffer = threadRayBuffer();
+    std::vector<RecordedRay> rays;
+    {
+        std::scoped_lock lock { buffer.mutex };
+        buffer.rays.push_back(RecordedRay {
+            .origin = ray.origin,
+            .direction = ray.direction,
+            .tMax = tMax,
+            .time = ray.time,
+            .t = ray.t,
+            .type = uint8_t(tracedRayType),
+            .hit = uint8_t(hit),
+            .primitiveType = uint8_t(hit ? hitInfo.primitive.type : PrimitiveType::None),
+            .query = uint8_t(query),
+            .instanceIdx = hit ? hitInfo.primitive.instanceIdx : 0,
+            .primitiveIdx = hit ? hitInfo.primitive.primitiveIdx : 0 });
+        if (buffer.rays.size() < rayBufferFlushSize)
+            return;
+        rays.swap(buffer.rays);
+    }
+    // The buffer is unlocked first: stopRayRecording locks the recording before the buffers.
+    RayRecording& recording = rayRecording();
+    std::scoped_lock lock { recording.mutex };
+    writeRays(recording, rays);
+}
+
+std::optional<std::vector<RecordedRay>> readRayDump(const std::filesystem::path& filePath)
+{
+    std::ifstream file { filePath, std::ios::binary };
+    RayDumpHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != RayDumpHeader {}.magic || header.version != RayDumpHeader {}.version)
+        return {};
+
+    std::error_code error;
+    const auto fileSize = std::filesystem::file_size(filePath, error);
+    if (error)
+        return {};
+    std::vector<RecordedRay> rays((fileSize - sizeof(header)) / sizeof(RecordedRay));
+    if (!file.read(reinterpret_cast<char*>(rays.data()), std::streamsize(rays.size() * sizeof(RecordedRay))))
+        return {};
+    return rays;
+}
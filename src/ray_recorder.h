@@ -0,0 +1,56 @@
+#pragma once
+#include "common.h"
+#include "ray_statistics.h"
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <framework/ray.h>
+#include <optional>
+#include <vector>
+
+// Capture of every ray that the BVH traces during a render, together with its result, so that the same workload
+// can be replayed through another BVH or intersector without the shading code (see ray_replay.cpp). Recording is
+// off until startRayRecording is called (see Config::rayDumpFile).
+//
+// A dump is a RayDumpHeader followed by RecordedRay records, in native byte order. Every thread buffers its rays
+// and appends them to the file in blocks, so the rays of different threads are interleaved.
+
+struct RayDumpHeader {
+    std::array<char, 4> magic { 'R', 'A', 'Y', 'D' };
+    uint32_t version = 2;
+};
+
+// What a ray was traced for: the closest hit (BoundingVolumeHierarchy::intersect) or any hit (occluded).
+enum class RayQuery : uint8_t {
+    ClosestHit,
+    AnyHit
+};
+
+struct RecordedRay {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float tMax; // Ray::t when it was traced.
+    float time;
+    float t; // Ray::t after it was traced; equal to tMax if nothing was hit.
+    uint8_t type; // RayType.
+    uint8_t hit;
+    uint8_t primitiveType; // PrimitiveType of the hit.
+    uint8_t query; // RayQuery. For any-hit queries, t and the primitive are of the first hit found, not the closest.
+    uint32_t instanceIdx; // Of the hit, see PrimitiveRef.
+    uint32_t primitiveIdx;
+};
+static_assert(sizeof(RecordedRay) == 48);
+
+// Start writing every traced ray to filePath. Returns false if the file could not be created.
+bool startRayRecording(const std::filesystem::path& filePath);
+// Write the rays that are still buffered by any thread and close the file. Returns the number of rays written.
+uint64_t stopRayRecording();
+[[nodiscard]] bool rayRecordingEnabled();
+
+// Set the type of the rays that the calling thread traces from now on, which is stored with them.
+void setTracedRayType(RayType type);
+// Record a ray that has just been traced (called by BoundingVolumeHierarchy::intersect and occluded while recording).
+void recordTracedRay(const Ray& ray, float tMax, bool hit, const HitInfo& hitInfo, RayQuery query = RayQuery::ClosestHit);
+
+// Read all rays of a dump, or nothing if the file cannot be read or is not a dump.
+std::optional<std::vector<RecordedRay>> readRayDump(const std::filesystem::path& filePath);
@@ -0,0 +1,185 @@
+#include "animation.h"
+#include "bounding_volume_hierarchy.h"
+#include "bvh_interface.h"
+#include "config.h"
+#include "draw.h"
+#include "ray_recorder.h"
+#include "scene.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/core.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <framework/variant_helper.h>
+#include <iostream>
+#include <variant>
+#include <vector>
+
+// Replays a ray dump of the command-line renderer (ray_dump_file in the config, see ray_recorder.h) through the BVH
+// of this build, without any shading, and checks that every ray gets the recorded result:
+//
+//   FinalProjectRayReplay config.toml rays.bin [--repetitions N] [--naive]
+//
+// The scene is loaded from the config that the dump was recorded with. The rays are traced N times (in parallel,
+// in the order of the dump) and the median time is reported per ray type. --naive intersects every primitive
+// instead of traversing the BVH, which checks the BVH itself against the reference. The exit code is non-zero if
+// any ray hits something else (or at a different distance) than when it was recorded. Rays that were traced as
+// occlusion queries (shadow rays, see RayQuery) are replayed as such and only checked for whether they hit.
+
+using clock_type = std::chrono::high_resolution_clock;
+
+// Hit distances may differ by this fraction when the traversal order or intersection code changes.
+static constexpr float hitDistanceTolerance = 1e-4f;
+
+static constexpr std::array rayTypeNames { "camera", "shadow", "reflection", "refraction" };
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " config.toml rays.bin [--repetitions N] [--naive]" << std::endl;
+}
+
+// The same scene as the command-line renderer, at frame 0 of an animation.
+static Scene loadConfigScene(const Config& config)
+{
+    Scene scene;
+    std::visit(make_visitor(
+                   [&](const std::filesystem::path& path) { scene = loadSceneFromFile(path, config.lights); },
+                   [&](const SceneType& type) { scene = loadScenePrebuilt(type, config.dataPath); }),
+        config.scene);
+    placeInstances(scene, config.instances);
+    return scene;
+}
+
+static bool samePrimitive(const RecordedRay& recorded, const PrimitiveRef& primitive)
+{
+    return PrimitiveType(recorded.primitiveType) == primitive.type && recorded.primitiveIdx == primitive.primitiveIdx
+        && (primitive.type != PrimitiveType::Triangle || recorded.instanceIdx == primitive.instanceIdx);
+}
+
+// The ray must hit the recorded primitive at the recorded distance. Another primitive at the same distance (e.g.
+// across an edge shared by two triangles) also matches if the recorded one is hit there too.
+static bool sameResult(const Scene& scene, const BoundingVolumeHierarchy& hierarchy, const RecordedRay& recorded, bool hit, const Ray& ray, const HitInfo& hitInfo)
+{
+    const auto sameDistance = [&](float t) { return std::abs(t - recorded.t) <= hitDistanceTolerance * std::max(recorded.t, 1.0f); };
+    if (bool(recorded.hit) != hit)
+        return false;
+    if (!hit)
+        return true;
+    if (!sameDistance(ray.t))
+        return false;
+    if (samePrimitive(recorded, hitInfo.primitive))
+        return true;
+
+    PrimitiveRef recordedPrimitive { PrimitiveType(recorded.primitiveType), 0, recorded.primitiveIdx, recorded.instanceIdx };
+    if (recordedPrimitive.type == PrimitiveType::Triangle && recorded.instanceIdx < scene.instances.size())
+        recordedPrimitive.meshIdx = scene.instances[recorded.instanceIdx].meshIdx;
+    Ray recordedRay { recorded.origin, recorded.direction, recorded.tMax, recorded.time };
+    HitInfo recordedHitInfo;
+    return hierarchy.intersectPrimitive(recordedPrimitive, recordedRay, recordedHitInfo) && sameDistance(recordedRay.t);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    int repetitions = 5;
+    bool naive = false;
+    for (int i = 3; i < argc; i++) {
+        if (std::strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+            repetitions = std::max(std::atoi(argv[++i]), 1);
+        } else if (std::strcmp(argv[i], "--naive") == 0) {
+            naive = true;
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    const Config config = readConfigFile(argv[1]);
+    const auto optRays = readRayDump(argv[2]);
+    if (!optRays) {
+        std::cerr << "Could not read the ray dump " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::vector<RecordedRay>& rays = *optRays;
+    if (config.animation.enabled())
+        std::cerr << "Warning: the scene is replayed at frame 0 of the animation; rays of later frames will not match." << std::endl;
+
+    enableDebugDraw = false;
+    Scene scene = loadConfigScene(config);
+    const auto buildStart = clock_type::now();
+    BvhInterface bvh { &scene };
+    const BoundingVolumeHierarchy* pHierarchy = BoundingVolumeHierarchy::ofScene(scene);
+    fmt::print("BVH built in {:.2f} ms\n", std::chrono::duration<double, std::milli>(clock_type::now() - buildStart).count());
+
+    Features features = config.features;
+    features.enableAccelStructure = !naive;
+    features.heatmap = HeatmapMode::None;
+
+    // Group the rays by type, keeping the order of the dump within each type.
+    std::array<std::vector<uint32_t>, rayTypeNames.size()> raysByType;
+    for (uint32_t rayIdx = 0; rayIdx < rays.size(); rayIdx++) {
+        if (rays[rayIdx].type < raysByType.size())
+            raysByType[rays[rayIdx].type].push_back(rayIdx);
+    }
+
+    std::vector<char> mismatches(rays.size(), 0);
+    fmt::print("{:<12} {:>12} {:>10} {:>12} {:>12} {:>12}\n", "rays", "count", "hits", "median ms", "Mrays/s", "mismatches");
+    size_t totalMismatches = 0;
+    for (size_t type = 0; type < raysByType.size(); type++) {
+        const std::vector<uint32_t>& indices = raysByType[type];
+        if (indices.empty())
+            continue;
+
+        std::vector<double> timesMs;
+        for (int repetition = 0; repetition < repetitions; repetition++) {
+            const auto start = clock_type::now();
+#ifdef NDEBUG
+#pragma omp parallel for schedule(guided)
+#endif
+            for (int j = 0; j < int(indices.size()); j++) {
+                const RecordedRay& recorded = rays[indices[size_t(j)]];
+                Ray ray { recorded.origin, recorded.direction, recorded.tMax, recorded.time };
+                bool hit;
+                if (RayQuery(recorded.query) == RayQuery::AnyHit) {
+                    PrimitiveRef occluder;
+                    hit = pHierarchy->occluded(ray, features, occluder);
+                    if (repetition == 0)
+                        mismatches[indices[size_t(j)]] = bool(recorded.hit) != hit;
+                } else {
+                    HitInfo hitInfo;
+                    hit = bvh.intersect(ray, hitInfo, features);
+                    if (repetition == 0)
+                        mismatches[indices[size_t(j)]] = !sameResult(scene, *pHierarchy, recorded, hit, ray, hitInfo);
+                }
+            }
+            timesMs.push_back(std::chrono::duration<double, std::milli>(clock_type::now() - start).count());
+        }
+        std::sort(std::begin(timesMs), std::end(timesMs));
+        const double medianMs = timesMs[timesMs.size() / 2];
+
+        size_t numHits = 0, numMismatches = 0;
+        for (uint32_t rayIdx : indices) {
+            numHits += rays[rayIdx].hit;
+            numMismatches += size_t(mismatches[rayIdx]);
+        }
+        totalMismatches += numMismatches;
+        fmt::print("{:<12} {:>12} {:>10} {:>12.2f} {:>12.2f} {:>12}\n",
+            rayTypeNames[type], indices.size(), numHits, medianMs, double(indices.size()) / (medianMs * 1e3), numMismatches);
+    }
+
+    if (totalMismatches > 0) {
+        std::cerr << totalMismatches << " of " << rays.size() << " rays do not match the dump." << std::endl;
+        return EXIT_FAILURE;
+    }
+    fmt::print("All {} rays match the dump.\n", rays.size());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+#include "ray_statistics.h"
+#include <iostream>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+static double perRay(uint64_t count, uint64_t numRays)
+{
+    return numRays > 0 ? double(count) / double(numRays) : 0.0;
+}
+
+double RayStatistics::hitsPerRay() const
+{
+    return perRay(hits, tracedRays);
+}
+
+double RayStatistics::nodesPerRay() const
+{
+    return perRay(nodesVisited, tracedRays);
+}
+
+double RayStatistics::primitivesPerRay() const
+{
+    return perRay(primitivesTested, tracedRays);
+}
+
+std::ostream& operator<<(std::ostream& os, const RayStatistics& statistics)
+{
+    os << "Ray statistics:" << std::endl
+       << "    - camera rays: " << statistics.cameraRays << std::endl
+       << "    - shadow rays: " << statistics.shadowRays << std::endl
+       << "    - reflection rays: " << statistics.reflectionRays << std::endl
+       << "    - refraction rays: " << statistics.refractionRays << std::endl
+       << "    - traced rays: " << statistics.tracedRays << std::endl
+       << "    - hits per ray: " << statistics.hitsPerRay() << std::endl
+       << "    - BVH nodes per ray: " << statistics.nodesPerRay() << std::endl
+       << "    - primitives tested per ray: " << statistics.primitivesPerRay() << std::endl;
+    return os;
+}
+
+static thread_local TraversalCost threadTraversalCost;
+
+void addThreadTraversalCost(uint64_t nodesVisited, uint64_t primitivesTested)
+{
+    threadTraversalCost.nodesVisited += nodesVisited;
+    threadTraversalCost.primitivesTested += primitivesTested;
+}
+
+TraversalCost takeThreadTraversalCost()
+{
+    return std::exchange(threadTraversalCost, TraversalCost {});
+}
+
+#ifdef ENABLE_RAY_STATISTICS
+namespace {
+struct CounterRegistry {
+    std::mutex mutex;
+    std::vector<ThreadRayCounters*> threads;
+    // What threads that have exited counted after the last collection.
+    std::array<uint64_t, ThreadRayCounters::NumCounters> exited {};
+};
+}
+
+static CounterRegistry& counterRegistry()
+{
+    static CounterRegistry registry;
+    return registry;
+}
+
+ThreadRayCounters::ThreadRayCounters()
+{
+    CounterRegistry& registry = counterRegistry();
+    std::scoped_lock lock { registry.mutex };
+    registry.threads.push_back(this);
+}
+
+ThreadRayCounters::~ThreadRayCounters()
+{
+    CounterRegistry& registry = counterRegistry();
+    std::scoped_lock lock { registry.mutex };
+    for (size_t counter = 0; counter < NumCounters; counter++)
+        registry.exited[counter] += m_counts[counter].load(std::memory_order_relaxed) - m_collected[counter];
+    std::erase(registry.threads, this);
+}
+
+ThreadRayCounters& threadRayCounters()
+{
+    static thread_local ThreadRayCounters counters;
+    return counters;
+}
+
+RayStatistics collectRayStatistics()
+{
+    CounterRegistry& registry = counterRegistry();
+    std::scoped_lock lock { registry.mutex };
+    std::array<uint64_t, ThreadRayCounters::NumCounters> counts = registry.exited;
+    registry.exited = {};
+    for (ThreadRayCounters* pThread : registry.threads) {
+        for (size_t counter = 0; counter < ThreadRayCounters::NumCounters; counter++) {
+            const uint64_t count = pThread->m_counts[counter].load(std::memory_order_relaxed);
+            counts[counter] += count - pThread->m_collected[counter];
+            pThread->m_collected[counter] = count;
+        }
+    }
+
+    RayStatistics statistics;
+    statistics.cameraRays = counts[ThreadRayCounters::CameraRays];
+    statistics.shadowRays = counts[ThreadRayCounters::ShadowRays];
+    statistics.reflectionRays = counts[ThreadRayCounters::ReflectionRays];
+    statistics.refractionRays = counts[ThreadRayCounters::RefractionRays];
+    statistics.tracedRays = counts[ThreadRayCounters::TracedRays];
+    statistics.hits = counts[ThreadRayCounters::Hits];
+    statistics.nodesVisited = counts[ThreadRayCounters::NodesVisited];
+    statistics.primitivesTested = counts[ThreadRayCounters::PrimitivesTested];
+    return statistics;
+}
+#else
+RayStatistics collectRayStatistics()
+{
+    return {};
+}
+#endif
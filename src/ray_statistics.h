@@ -0,0 +1,123 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+
+// Counters of the rays that are traced and of the work they cause in the BVH, to tell whether a slow frame comes
+// from the quality of the BVH, the number of shadow rays or deep recursion. They are only compiled in when the
+// ENABLE_RAY_STATISTICS option is set in CMake; otherwise the counting functions are empty and the statistics zero.
+
+// Kinds of rays, counted where they are created.
+enum class RayType {
+    Camera,
+    Shadow,
+    Reflection,
+    Refraction
+};
+
+struct RayStatistics {
+    uint64_t cameraRays = 0;
+    uint64_t shadowRays = 0;
+    uint64_t reflectionRays = 0;
+    uint64_t refractionRays = 0;
+    // Rays intersected with the scene by BoundingVolumeHierarchy::intersect, of any kind, and how many of them hit.
+    uint64_t tracedRays = 0;
+    uint64_t hits = 0;
+    // Nodes popped from the traversal stack (of the top- and bottom-level trees), and primitives intersected.
+    uint64_t nodesVisited = 0;
+    uint64_t primitivesTested = 0;
+
+    [[nodiscard]] uint64_t totalRays() const { return cameraRays + shadowRays + reflectionRays + refractionRays; }
+    // Averages per traced ray.
+    [[nodiscard]] double hitsPerRay() const;
+    [[nodiscard]] double nodesPerRay() const;
+    [[nodiscard]] double primitivesPerRay() const;
+};
+
+std::ostream& operator<<(std::ostream& os, const RayStatistics& statistics);
+
+// Return what was counted since the previous call, summed over all threads (including threads that have exited).
+// Can be called while other threads are still counting.
+RayStatistics collectRayStatistics();
+
+// Traversal work of the rays that the calling thread traced, for the heatmap render (see heatmap.h). Unlike the
+// statistics above this is always compiled in, but BoundingVolumeHierarchy::intersect only adds to it while a
+// heatmap is rendered.
+struct TraversalCost {
+    uint64_t nodesVisited = 0;
+    uint64_t primitivesTested = 0;
+};
+
+void addThreadTraversalCost(uint64_t nodesVisited, uint64_t primitivesTested);
+// Return the cost added by the calling thread since the previous call, and reset it.
+TraversalCost takeThreadTraversalCost();
+
+#ifdef ENABLE_RAY_STATISTICS
+inline constexpr bool rayStatisticsEnabled = true;
+
+// The counters of one thread. Only the owning thread changes them, with a separate load and store rather than an
+// atomic increment: that is as cheap as a plain increment, and collectRayStatistics can still read them at any time.
+class ThreadRayCounters {
+public:
+    enum Counter {
+        CameraRays, // The first four are in the order of RayType.
+        ShadowRays,
+        ReflectionRays,
+        RefractionRays,
+        TracedRays,
+        Hits,
+        NodesVisited,
+        PrimitivesTested,
+        NumCounters
+    };
+
+    ThreadRayCounters();
+    ~ThreadRayCounters();
+    ThreadRayCounters(const ThreadRayCounters&) = delete;
+    ThreadRayCounters& operator=(const ThreadRayCounters&) = delete;
+
+    void add(Counter counter, uint64_t count)
+    {
+        std::atomic<uint64_t>& value = m_counts[counter];
+        value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+
+private:
+    friend RayStatistics collectRayStatistics();
+
+    std::array<std::atomic<uint64_t>, NumCounters> m_counts {};
+    // The counts up to the previous collectRayStatistics (only accessed by it, under its lock).
+    std::array<uint64_t, NumCounters> m_collected {};
+};
+
+// The counters of the calling thread.
+ThreadRayCounters& threadRayCounters();
+
+inline void countRays(RayType type, uint64_t count = 1)
+{
+    threadRayCounters().add(ThreadRayCounters::Counter(type), count);
+}
+
+// Count one ray intersected with the scene; traversal sums its node visits and primitive tests locally and counts
+// them once per ray.
+inline void countTracedRay(bool hit, uint64_t nodesVisited, uint64_t primitivesTested)
+{
+    ThreadRayCounters& counters = threadRayCounters();
+    counters.add(ThreadRayCounters::TracedRays, 1);
+    counters.add(ThreadRayCounters::Hits, hit ? 1 : 0);
+    counters.add(ThreadRayCounters::NodesVisited, nodesVisited);
+    counters.add(ThreadRayCounters::PrimitivesTested, primitivesTested);
+}
+
+inline void countPrimitiveTests(uint64_t count)
+{
+    threadRayCounters().add(ThreadRayCounters::PrimitivesTested, count);
+}
+#else
+inline constexpr bool rayStatisticsEnabled = false;
+
+inline void countRays(RayType, uint64_t = 1) { }
+inline void countTracedRay(bool, uint64_t, uint64_t) { }
+inline void countPrimitiveTests(uint64_t) { }
+#endif
@@ -0,0 +1,119 @@
+#include "ray_stream.h"
+#include "bvh_interface.h"
+#include "ray_recorder.h"
+#include "scene.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <limits>
+#include <utility>
+#ifdef NDEBUG
+#include <omp.h>
+#endif
+
+AxisAlignedBox computeSceneBounds(const Scene& scene)
+{
+    AxisAlignedBox bounds { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+    // Transform the corners of the bounds of each mesh, rather than every vertex of every instance.
+    std::vector<AxisAlignedBox> meshBounds(scene.meshes.size(), AxisAlignedBox { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) });
+    for (size_t meshIdx = 0; meshIdx < scene.meshes.size(); meshIdx++) {
+        for (const auto& vertex : scene.meshes[meshIdx].vertices) {
+            meshBounds[meshIdx].lower = glm::min(meshBounds[meshIdx].lower, vertex.position);
+            meshBounds[meshIdx].upper = glm::max(meshBounds[meshIdx].upper, vertex.position);
+        }
+    }
+    for (const auto& instance : scene.instances) {
+        const AxisAlignedBox& box = meshBounds[instance.meshIdx];
+        if (box.lower.x > box.upper.x)
+            continue;
+        // Moving instances stay between where they are when the shutter opens and closes.
+        for (float time : { 0.0f, 1.0f }) {
+            const glm::mat4 transform = instance.transformAt(time);
+            for (int corner = 0; corner < 8; corner++) {
+                const glm::vec3 position { (corner & 1) ? box.upper.x : box.lower.x, (corner & 2) ? box.upper.y : box.lower.y, (corner & 4) ? box.upper.z : box.lower.z };
+                const glm::vec3 transformed = glm::vec3(transform * glm::vec4(position, 1.0f));
+                bounds.lower = glm::min(bounds.lower, transformed);
+                bounds.upper = glm::max(bounds.upper, transformed);
+            }
+        }
+    }
+    for (const auto& sphere : scene.spheres) {
+        bounds.lower = glm::min(bounds.lower, sphere.center - sphere.radius);
+        bounds.upper = glm::max(bounds.upper, sphere.center + sphere.radius);
+    }
+    if (bounds.lower.x > bounds.upper.x)
+        return AxisAlignedBox { glm::vec3(0.0f), glm::vec3(0.0f) };
+    return bounds;
+}
+
+// Spread the lower 10 bits of x such that there are two zero bits between each of them.
+static uint64_t expandBits(uint32_t x)
+{
+    uint64_t v = x & 0x3ffu;
+    v = (v | (v << 16)) & 0x030000ffu;
+    v = (v | (v << 8)) & 0x0300f00fu;
+    v = (v | (v << 4)) & 0x030c30c3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+}
+
+// 30 bit Morton code of a point in [0, 1]^3.
+static uint64_t morton3D(const glm::vec3& p)
+{
+    const glm::uvec3 q { glm::clamp(p * 1024.0f, glm::vec3(0.0f), glm::vec3(1023.0f)) };
+    return (expandBits(q.x) << 2) | (expandBits(q.y) << 1) | expandBits(q.z);
+}
+
+uint64_t computeRayCoherenceKey(const Ray& ray, const AxisAlignedBox& sceneBounds)
+{
+    const uint64_t octant = (ray.direction.x < 0.0f ? 4u : 0u) | (ray.direction.y < 0.0f ? 2u : 0u) | (ray.direction.z < 0.0f ? 1u : 0u);
+    const glm::vec3 extent = glm::max(sceneBounds.upper - sceneBounds.lower, glm::vec3(1e-6f));
+    const uint64_t origin = morton3D((ray.origin - sceneBounds.lower) / extent);
+    const uint64_t direction = morton3D(ray.direction * 0.5f + 0.5f);
+    return (octant << 60) | (origin << 30) | direction;
+}
+
+void sortRaysByCoherence(std::span<const Ray> rays, const AxisAlignedBox& sceneBounds, std::vector<uint32_t>& order)
+{
+    std::vector<std::pair<uint64_t, uint32_t>> keys(rays.size());
+    const int numRays = int(rays.size());
+#ifdef NDEBUG
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < numRays; i++)
+        keys[size_t(i)] = { computeRayCoherenceKey(rays[size_t(i)], sceneBounds), uint32_t(i) };
+    std::sort(std::begin(keys), std::end(keys));
+
+    order.resize(keys.size());
+    std::transform(std::begin(keys), std::end(keys), std::begin(order), [](const auto& key) { return key.second; });
+}
+
+void intersectRayStream(const BvhInterface& bvh, std::span<Ray> rays, std::span<const uint32_t> order, std::span<HitInfo> hits, std::span<char> hitMask, const Features& features, RayType rayType)
+{
+    const int numRays = int(order.size());
+#ifdef NDEBUG
+#pragma omp parallel for schedule(guided)
+#endif
+    for (int j = 0; j < numRays; j++) {
+        const uint32_t i = order[size_t(j)];
+        setTracedRayType(rayType);
+        hitMask[i] = bvh.intersect(rays[i], hits[i], features);
+    }
+}
+
+void occludedRayStream(const BvhInterface& bvh, std::span<Ray> rays, std::span<const uint32_t> order, std::span<char> occluded, const Features& features)
+{
+    const int numRays = int(order.size());
+#ifdef NDEBUG
+#pragma omp parallel for schedule(guided)
+#endif
+    for (int j = 0; j < numRays; j++) {
+        const uint32_t i = order[size_t(j)];
+        HitInfo hitInfo;
+        setTracedRayType(RayType::Shadow);
+        occluded[i] = bvh.intersect(rays[i], hitInfo, features);
+    }
+}
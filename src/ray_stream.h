@@ -0,0 +1,30 @@
+#pragma once
+#include "common.h"
+#include "ray_statistics.h"
+#include <cstdint>
+#include <framework/ray.h>
+#include <span>
+#include <vector>
+
+// Forward declarations.
+class BvhInterface;
+struct Scene;
+
+// Bounding box of all geometry in the scene.
+AxisAlignedBox computeSceneBounds(const Scene& scene);
+
+// Sort key that places coherent rays next to each other: the direction octant, followed by interleaved (Morton)
+// bits of the origin (quantized within sceneBounds) and of the direction.
+uint64_t computeRayCoherenceKey(const Ray& ray, const AxisAlignedBox& sceneBounds);
+
+// Fill order with the indices of rays, sorted by computeRayCoherenceKey.
+void sortRaysByCoherence(std::span<const Ray> rays, const AxisAlignedBox& sceneBounds, std::vector<uint32_t>& order);
+
+// Intersect a batch of rays, in the order given by order (e.g. from sortRaysByCoherence). Consecutive rays in
+// that order are handed to the same thread so that they traverse the same BVH nodes while those are still in cache.
+// Writes the closest hit of rays[i] to hits[i] and whether there was a hit to hitMask[i]. The rays are recorded as
+// rayType when a ray dump is recorded (see ray_recorder.h).
+void intersectRayStream(const BvhInterface& bvh, std::span<Ray> rays, std::span<const uint32_t> order, std::span<HitInfo> hits, std::span<char> hitMask, const Features& features, RayType rayType);
+
+// Same as intersectRayStream but only reports whether each ray hits anything (e.g. shadow rays).
+void occludedRayStream(const BvhInterface& bvh, std::span<Ray> rays, std::span<const uint32_t> order, std::span<char> occluded, const Features& features);
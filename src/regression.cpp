@@ -0,0 +1,276 @@
+#include "bvh_interface.h"
+#include "config.h"
+#include "draw.h"
+#include "heatmap.h"
+#include "render.h"
+#include "scene.h"
+#include "screen.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/core.h>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <framework/trackball.h>
+#include <framework/window.h>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Renders every prebuilt scene headless and compares it against a reference image, so that optimizations of the
+// renderer, the BVH or the samplers cannot silently change the output:
+//
+//   FinalProjectRegression --references DIR [--update] [--output DIR] [--budgets] [--resolution WxH]
+//                          [--repetitions N] [--tolerance RMSE]
+//
+// Each scene is rendered with a fixed camera and feature set and compared with DIR/<scene>.pfm. A scene fails when
+// the root-mean-square error of the display (sRGB) values exceeds the tolerance, when more than 0.1% of the pixels
+// differ visibly (a CIELAB colour difference above the just noticeable difference), or when the fastest of the N
+// renders exceeds the budget of the scene in DIR/budgets.toml. Render times depend on the machine and the build, so
+// the budgets are only checked with --budgets.
+// The render and a heatmap of the differences of failing scenes are written to the output directory, which is the
+// reference directory by default. The exit code is non-zero if any scene failed.
+//
+// --update renders new references instead, and sets the budget of every scene to three times its render time.
+// The references in data/regression are rendered at the default resolution and checked by CTest, which only checks
+// their budgets when configured with REGRESSION_TIME_BUDGETS.
+
+using clock_type = std::chrono::high_resolution_clock;
+
+// Colour difference (CIE76 delta E) that is just noticeable.
+static constexpr float justNoticeableDifference = 2.3f;
+// Fraction of the pixels that may differ by more than justNoticeableDifference.
+static constexpr float maxVisiblyDifferentPixels = 0.001f;
+// The budget of a scene is its render time times this factor when the references are updated.
+static constexpr double budgetSlack = 3.0;
+
+static Features regressionFeatures()
+{
+    Features features {};
+    features.enableShading = true;
+    features.enableRecursive = true;
+    features.enableHardShadow = true;
+    features.enableSoftShadow = true;
+    features.enableNormalInterp = true;
+    features.enableTextureMapping = true;
+    features.enableAccelStructure = true;
+    features.enableLightSampling = true;
+    return features;
+}
+
+// Read a PFM image as written by Screen::writePfmToFile, with the rows in the order of Screen::pixels().
+static std::optional<std::vector<glm::vec3>> readPfm(const std::filesystem::path& filePath, const glm::ivec2& resolution)
+{
+    std::ifstream file { filePath, std::ios::binary };
+    std::string format;
+    int width = 0, height = 0;
+    float scale = 0.0f;
+    if (!(file >> format >> width >> height >> scale) || format != "PF" || width != resolution.x || height != resolution.y)
+        return {};
+    if ((scale < 0.0f) != (std::endian::native == std::endian::little))
+        return {};
+    file.get(); // The single whitespace character after the scale.
+
+    std::vector<glm::vec3> pixels(size_t(width) * size_t(height));
+    const auto rowSize = std::streamsize(size_t(width) * sizeof(glm::vec3));
+    for (int y = height - 1; y >= 0; y--) {
+        if (!file.read(reinterpret_cast<char*>(&pixels[size_t(y) * size_t(width)]), rowSize))
+            return {};
+    }
+    return pixels;
+}
+
+static float toSrgb(float linear)
+{
+    linear = std::clamp(linear, 0.0f, 1.0f);
+    return linear <= 0.0031308f ? 12.92f * linear : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+// CIELAB coordinates of a linear sRGB colour (D65 white point).
+static glm::vec3 toLab(const glm::vec3& linearRgb)
+{
+    const glm::vec3 rgb = glm::clamp(linearRgb, 0.0f, 1.0f);
+    const glm::vec3 xyz {
+        (0.4124f * rgb.r + 0.3576f * rgb.g + 0.1805f * rgb.b) / 0.95047f,
+        0.2126f * rgb.r + 0.7152f * rgb.g + 0.0722f * rgb.b,
+        (0.0193f * rgb.r + 0.1192f * rgb.g + 0.9505f * rgb.b) / 1.08883f
+    };
+    const auto f = [](float t) { return t > 0.008856f ? std::cbrt(t) : 7.787f * t + 16.0f / 116.0f; };
+    const glm::vec3 fxyz { f(xyz.x), f(xyz.y), f(xyz.z) };
+    return { 116.0f * fxyz.y - 16.0f, 500.0f * (fxyz.x - fxyz.y), 200.0f * (fxyz.y - fxyz.z) };
+}
+
+struct ImageDifference {
+    float rmse = 0.0f; // Of the sRGB values, in [0, 1].
+    float visiblyDifferentPixels = 0.0f; // Fraction of the pixels.
+    std::vector<float> deltaE; // Per pixel.
+};
+
+static ImageDifference compareImages(const std::vector<glm::vec3>& image, const std::vector<glm::vec3>& reference)
+{
+    ImageDifference difference;
+    difference.deltaE.resize(image.size());
+    double sumSquaredError = 0.0;
+    size_t numVisiblyDifferent = 0;
+    for (size_t i = 0; i < image.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            const double error = toSrgb(image[i][c]) - toSrgb(reference[i][c]);
+            sumSquaredError += error * error;
+        }
+        difference.deltaE[i] = glm::distance(toLab(image[i]), toLab(reference[i]));
+        numVisiblyDifferent += size_t(difference.deltaE[i] > justNoticeableDifference);
+    }
+    difference.rmse = float(std::sqrt(sumSquaredError / double(3 * image.size())));
+    difference.visiblyDifferentPixels = float(numVisiblyDifferent) / float(image.size());
+    return difference;
+}
+
+// Map the per-pixel differences to the heatmap colours, where the top of the scale is ten times the JND.
+static void writeDifferenceImage(const std::vector<float>& deltaE, const glm::ivec2& resolution, const std::filesystem::path& filePath)
+{
+    Screen screen { resolution, false };
+    std::transform(std::begin(deltaE), std::end(deltaE), std::begin(screen.pixels()),
+        [](float difference) { return heatmapColor(difference / (10.0f * justNoticeableDifference)); });
+    screen.writeBitmapToFile(filePath);
+}
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " --references DIR [--update] [--output DIR] [--budgets] [--resolution WxH] [--repetitions N] [--tolerance RMSE]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::optional<std::filesystem::path> referenceDir, outputDir;
+    bool update = false, useBudgets = false;
+    glm::ivec2 resolution { 128, 128 };
+    int repetitions = 3;
+    float tolerance = 0.01f;
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--references") == 0 && hasValue) {
+            referenceDir = argv[++i];
+        } else if (std::strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else if (std::strcmp(argv[i], "--output") == 0 && hasValue) {
+            outputDir = argv[++i];
+        } else if (std::strcmp(argv[i], "--budgets") == 0) {
+            useBudgets = true;
+        } else if (std::strcmp(argv[i], "--resolution") == 0 && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &resolution.x, &resolution.y) != 2 || resolution.x <= 0 || resolution.y <= 0) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--repetitions") == 0 && hasValue) {
+            repetitions = std::max(std::atoi(argv[++i]), 1);
+        } else if (std::strcmp(argv[i], "--tolerance") == 0 && hasValue) {
+            tolerance = float(std::atof(argv[++i]));
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!referenceDir) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!outputDir)
+        outputDir = referenceDir;
+    std::filesystem::create_directories(*referenceDir);
+    std::filesystem::create_directories(*outputDir);
+
+    // Trackball needs a window; like the command-line renderer, create one that is never shown.
+    enableDebugDraw = false;
+    Window window { "Final Project Regression", resolution, OpenGLVersion::GL2, false };
+    const CameraConfig cameraConfig {};
+    Trackball camera { &window, glm::radians(cameraConfig.fieldOfView), cameraConfig.distanceFromLookAt };
+    camera.setCamera(cameraConfig.lookAt, glm::radians(cameraConfig.rotation), cameraConfig.distanceFromLookAt);
+
+    const Features features = regressionFeatures();
+    const std::filesystem::path budgetsPath = *referenceDir / "budgets.toml";
+    std::map<std::string, double> budgets = readNumberTable(budgetsPath);
+    int numFailed = 0;
+    fmt::print("{:<34} {:>10} {:>10} {:>10} {:>10}  {}\n", "scene", "ms", "budget", "rmse", "visible", "result");
+    for (int sceneTypeIdx = SceneType::SingleTriangle; sceneTypeIdx <= SceneType::Custom; sceneTypeIdx++) {
+        const auto sceneType = SceneType(sceneTypeIdx);
+        const std::string sceneName = serialize(sceneType);
+        Scene scene;
+        try {
+            scene = loadScenePrebuilt(sceneType, Config {}.dataPath);
+        } catch (const std::exception&) {
+            fmt::print("{:<34} {:>10} {:>10} {:>10} {:>10}  skipped (could not be loaded)\n", sceneName, "", "", "", "");
+            continue;
+        }
+        BvhInterface bvh { &scene };
+
+        Screen screen { resolution, false };
+        double renderMs = std::numeric_limits<double>::max();
+        for (int repetition = 0; repetition < repetitions; repetition++) {
+            screen.clear(glm::vec3(0.0f));
+            const auto start = clock_type::now();
+            renderRayTracing(scene, camera, bvh, screen, features);
+            renderMs = std::min(renderMs, std::chrono::duration<double, std::milli>(clock_type::now() - start).count());
+        }
+
+        const std::filesystem::path referencePath = *referenceDir / (sceneName + ".pfm");
+        if (update) {
+            screen.writePfmToFile(referencePath);
+            budgets[sceneName] = std::ceil(budgetSlack * renderMs);
+            fmt::print("{:<34} {:>10.1f} {:>10.1f} {:>10} {:>10}  updated\n", sceneName, renderMs, budgets[sceneName], "", "");
+            continue;
+        }
+
+        const auto optReference = readPfm(referencePath, resolution);
+        const auto budget = budgets.find(sceneName);
+        const std::string budgetString = budget != std::end(budgets) ? fmt::format("{:.1f}", budget->second) : "-";
+        if (!optReference) {
+            fmt::print("{:<34} {:>10.1f} {:>10} {:>10} {:>10}  FAILED (no reference at this resolution)\n", sceneName, renderMs, budgetString, "", "");
+            numFailed++;
+            continue;
+        }
+
+        const ImageDifference difference = compareImages(screen.pixels(), *optReference);
+        std::string failures;
+        if (difference.rmse > tolerance)
+            failures += " rmse";
+        if (difference.visiblyDifferentPixels > maxVisiblyDifferentPixels)
+            failures += " visible-differences";
+        if (useBudgets && budget != std::end(budgets) && renderMs > budget->second)
+            failures += " over-budget";
+        fmt::print("{:<34} {:>10.1f} {:>10} {:>10.5f} {:>9.3f}%  {}\n", sceneName, renderMs, budgetString, difference.rmse,
+            100.0f * difference.visiblyDifferentPixels, failures.empty() ? "ok" : "FAILED:" + failures);
+        if (!failures.empty()) {
+            screen.writePfmToFile(*outputDir / (sceneName + "_render.pfm"));
+            writeDifferenceImage(difference.deltaE, resolution, *outputDir / (sceneName + "_diff.bmp"));
+            numFailed++;
+        }
+    }
+
+    if (update) {
+        std::ofstream file { budgetsPath };
+        file << "# Render time budgets in milliseconds, per scene (see src/regression.cpp).\n";
+        for (const auto& [sceneName, budget] : budgets)
+            file << sceneName << " = " << fmt::format("{:.1f}", budget) << "\n";
+        fmt::print("References written to {}\n", referenceDir->string());
+        return EXIT_SUCCESS;
+    }
+    if (numFailed > 0) {
+        fmt::print("{} scene(s) failed; renders and difference images were written to {}\n", numFailed, outputDir->string());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,53 +1,106 @@
 #include "render.h"
+#include "heatmap.h"
 #include "intersect.h"
 #include "light.h"
+#include "ray_recorder.h"
+#include "ray_statistics.h"
+#include "sampler.h"
 #include "screen.h"
+#include "trace_events.h"
+#include "wavefront.h"
+#include <algorithm>
 #include <framework/trackball.h>
 #ifdef NDEBUG
 #include <omp.h>
 #endif
 
-glm::vec3 getFinalColor(const Scene& scene, const BvhInterface& bvh, Ray ray, const Features& features, int rayDepth)
+// Russian roulette is only applied after this many bounces, so that the first reflections are never terminated early.
+static constexpr int russianRouletteMinDepth = 2;
+
+bool continuePath(const Features& features, const HitInfo& hitInfo, int depth, Sampler& sampler, glm::vec3& throughput)
 {
-    HitInfo hitInfo;
-    if (bvh.intersect(ray, hitInfo, features)) {
+    if (!features.enableRecursive || depth >= features.maxRayDepth || hitInfo.material.ks == glm::vec3(0.0f))
+        return false;
 
-        glm::vec3 Lo = computeLightContribution(scene, bvh, features, ray, hitInfo);
+    throughput *= hitInfo.material.ks;
+    if (features.enableRussianRoulette && depth >= russianRouletteMinDepth) {
+        // Continue with a probability proportional to the remaining throughput and reweight the survivors.
+        const float survivalProbability = std::min(std::max({ throughput.x, throughput.y, throughput.z }), 1.0f);
+        if (sampler.next1D() >= survivalProbability)
+            return false;
+        throughput /= survivalProbability;
+    }
+    return true;
+}
 
-        if (features.enableRecursive) {
-            Ray reflection = computeReflectionRay(ray, hitInfo);
-            // TODO: put your own implementation of recursive ray tracing here.
+// The ray tree is evaluated iteratively: instead of recursing for every reflection (and copying the ray, hit and
+// material at every level), the loop carries the path throughput (the product of the specular coefficients along
+// the path) and adds the light contribution at each hit weighted by it. The loop ends when the ray misses, hits a
+// non-specular surface, reaches features.maxRayDepth bounces, or is terminated by Russian roulette (see continuePath).
+glm::vec3 getFinalColor(const Scene& scene, const BvhInterface& bvh, Ray ray, const Features& features, Sampler& sampler, int rayDepth)
+{
+    glm::vec3 color { 0.0f };
+    glm::vec3 throughput { 1.0f };
+    for (int depth = rayDepth;; depth++) {
+        sampler.startBounce(depth);
+        const RayType rayType = depth == 0 ? RayType::Camera : RayType::Reflection;
+        countRays(rayType);
+        setTracedRayType(rayType);
+        HitInfo hitInfo;
+        if (!bvh.intersect(ray, hitInfo, features)) {
+            // Draw a red debug ray if the ray missed.
+            drawRay(ray, glm::vec3(1.0f, 0.0f, 0.0f));
+            // Rays that miss contribute black.
+            break;
         }
 
+        const glm::vec3 Lo = computeLightContribution(scene, bvh, features, sampler, ray, hitInfo);
+        color += throughput * Lo;
+
         // Draw a white debug ray if the ray hits.
         drawRay(ray, glm::vec3(1.0f));
 
-        // Set the color of the pixel to white if the ray hits.
-        return Lo;
-    } else {
-        // Draw a red debug ray if the ray missed.
-        drawRay(ray, glm::vec3(1.0f, 0.0f, 0.0f));
-        // Set the color of the pixel to black if the ray misses.
-        return glm::vec3(0.0f);
+        if (!continuePath(features, hitInfo, depth, sampler, throughput))
+            break;
+        ray = computeReflectionRay(ray, hitInfo);
     }
+    return color;
 }
 
-void renderRayTracing(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features)
+void renderRayTracing(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, int frame, const std::optional<RenderRegion>& region)
 {
+    if (features.heatmap != HeatmapMode::None) {
+        renderHeatmap(scene, camera, bvh, screen, features, frame, region);
+        return;
+    }
+    if (features.enableWavefront) {
+        renderRayTracingWavefront(scene, camera, bvh, screen, features, frame, region);
+        return;
+    }
+
     glm::ivec2 windowResolution = screen.resolution();
+    const RenderRegion imageRegion = region.value_or(RenderRegion { windowResolution });
+    // The shadow occluders cached while rendering the previous frame may not be in this one.
+    resetShadowOccluderCache();
     // Enable multi threading in Release mode
 #ifdef NDEBUG
 #pragma omp parallel for schedule(guided)
 #endif
     for (int y = 0; y < windowResolution.y; y++) {
+        TraceScope traceScope { "render row" };
         for (int x = 0; x != windowResolution.x; x++) {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::ivec2 imagePixel = imageRegion.offset + glm::ivec2(x, y);
+            // NOTE: (-1, -1) at the bottom left of the image, (+1, +1) at the top right of the image.
             const glm::vec2 normalizedPixelPos {
-                float(x) / float(windowResolution.x) * 2.0f - 1.0f,
-                float(y) / float(windowResolution.y) * 2.0f - 1.0f
+                float(imagePixel.x) / float(imageRegion.imageResolution.x) * 2.0f - 1.0f,
+                float(imagePixel.y) / float(imageRegion.imageResolution.y) * 2.0f - 1.0f
             };
-            const Ray cameraRay = camera.generateRay(normalizedPixelPos);
-            screen.setPixel(x, y, getFinalColor(scene, bvh, cameraRay, features));
+            Ray cameraRay = camera.generateRay(normalizedPixelPos);
+            // Seed the sampler with the pixel so that the image does not depend on which thread renders it.
+            Sampler sampler { pixelSeed(imagePixel.x, imagePixel.y, frame) };
+            if (features.extra.enableMotionBlur)
+                cameraRay.time = sampler.next1D();
+            screen.setPixel(x, y, getFinalColor(scene, bvh, cameraRay, features, sampler));
         }
     }
 }
\ No newline at end of file
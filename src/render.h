@@ -2,19 +2,39 @@
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
 #include <framework/ray.h>
+#include <optional>
 
 // Forward declarations.
 struct Scene;
 class Screen;
 class Trackball;
 class BvhInterface;
+class Sampler;
 struct Features;
+struct HitInfo;
 
-// Main rendering function.
-void renderRayTracing(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features);
+// The part of an image that a render fills the screen with: the pixels from offset up to offset + screen.resolution()
+// of an image of resolution imageResolution (origin at the bottom left, like Screen). Pixels are traced and seeded
+// with their coordinates in the whole image, so they come out exactly as in a render of the whole image.
+struct RenderRegion {
+    glm::ivec2 imageResolution;
+    glm::ivec2 offset { 0 };
+};
+
+// Main rendering function. The frame (of an animation) only changes the random numbers (see pixelSeed). Renders
+// the whole image into the screen unless a region is given.
+void renderRayTracing(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, int frame = 0, const std::optional<RenderRegion>& region = {});
 
 // Get the color of a ray.
-glm::vec3 getFinalColor(const Scene& scene, const BvhInterface& bvh, Ray ray, const Features& features, int rayDepth = 0);
\ No newline at end of file
+// All stochastic decisions (area light samples, and the glossy reflection / depth of field extras) should draw
+// their random numbers from sampler, which is created per pixel sample by renderRayTracing and moved on to the
+// dimensions of every bounce (see Sampler::startBounce).
+glm::vec3 getFinalColor(const Scene& scene, const BvhInterface& bvh, Ray ray, const Features& features, Sampler& sampler, int rayDepth = 0);
+
+// Decide whether the path continues with a reflection after the hit at the given depth. If so, throughput is
+// multiplied by the specular coefficient (and reweighted when Russian roulette lets the path survive).
+bool continuePath(const Features& features, const HitInfo& hitInfo, int depth, Sampler& sampler, glm::vec3& throughput);
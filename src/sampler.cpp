@@ -0,0 +1,99 @@
+#include "sampler.h"
+
+// Integer hash with good avalanche behaviour (https://nullprogram.com/blog/2018/07/31/).
+static uint32_t hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t hashCombine(uint32_t seed, uint32_t value)
+{
+    return seed ^ (hash(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+static uint32_t reverseBits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Owen scrambling of a bit-reversed value (Laine and Karras 2011, with the constants from Burley 2020).
+static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// Second dimension of the Sobol sequence (the first one is the bit reversal of the index).
+static uint32_t sobolDimension1(uint32_t index)
+{
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1u)
+            result ^= v;
+    }
+    return result;
+}
+
+// Map the upper 24 bits to a float in [0, 1).
+static float toUnitFloat(uint32_t x)
+{
+    return float(x >> 8) * 0x1p-24f;
+}
+
+Sampler::Sampler(uint32_t seed, uint32_t sampleIndex)
+    : m_pixelSeed(hash(seed))
+    , m_seed(hashCombine(m_pixelSeed, 0))
+    , m_sampleIndex(sampleIndex)
+{
+}
+
+void Sampler::startBounce(int depth)
+{
+    m_seed = hashCombine(m_pixelSeed, uint32_t(depth) + 1);
+    m_dimension = 0;
+}
+
+float Sampler::next1D()
+{
+    const uint32_t dimensionSeed = hashCombine(m_seed, m_dimension++);
+    const uint32_t index = nestedUniformScramble(m_sampleIndex, dimensionSeed);
+    return toUnitFloat(nestedUniformScramble(reverseBits(index), hashCombine(dimensionSeed, 0)));
+}
+
+glm::vec2 Sampler::next2D()
+{
+    const uint32_t dimensionSeed = hashCombine(m_seed, m_dimension++);
+    const uint32_t index = nestedUniformScramble(m_sampleIndex, dimensionSeed);
+    return glm::vec2 {
+        toUnitFloat(nestedUniformScramble(reverseBits(index), hashCombine(dimensionSeed, 0))),
+        toUnitFloat(nestedUniformScramble(sobolDimension1(index), hashCombine(dimensionSeed, 1)))
+    };
+}
+
+uint32_t Sampler::nextSeed()
+{
+    return hashCombine(m_seed, m_dimension++);
+}
+
+uint32_t pixelSeed(int x, int y, int frame)
+{
+    return hashCombine(hashCombine(hash(uint32_t(x)), uint32_t(y)), uint32_t(frame));
+}
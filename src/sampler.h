@@ -0,0 +1,47 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+
+// Deterministic low-discrepancy sampler based on hash-based Owen-scrambled Sobol points
+// ("Practical Hash-based Owen Scrambling", Burley 2020).
+//
+// A sampler is created per pixel (the seed) and per sample within that pixel (the index). Each call to
+// next1D()/next2D() moves on to the next dimension; every dimension uses the first two Sobol dimensions,
+// shuffled and scrambled with its own seed. Samples with consecutive indices are therefore stratified
+// against each other in every dimension, while different pixels and dimensions stay decorrelated.
+// No state is shared between samplers, so they can be used from any number of threads.
+//
+// The renderers seed the sampler of a pixel with pixelSeed and call startBounce at every hit along its path, so that
+// every random number is determined by (pixel, sample index, bounce, frame) and an image is the same whichever thread
+// renders which pixel, and in partial renders.
+class Sampler {
+public:
+    explicit Sampler(uint32_t seed, uint32_t sampleIndex = 0);
+
+    // Move on to the dimensions of the hit at the given depth along the path (0 for the hit of the camera ray);
+    // before the first call the sampler draws the dimensions of the camera ray (time, lens position). The numbers
+    // drawn at a bounce do not depend on how many were drawn at earlier ones, which varies with the lights that
+    // were sampled and with Russian roulette.
+    void startBounce(int depth);
+
+    // Next dimension of the current sample, in [0, 1).
+    float next1D();
+    glm::vec2 next2D();
+
+    // Returns a seed for a nested sequence (e.g. the samples on an area light) and moves on to the next dimension.
+    // Samplers constructed with this seed and indices 0..N-1 produce N stratified samples.
+    uint32_t nextSeed();
+
+private:
+    uint32_t m_pixelSeed;
+    uint32_t m_seed; // Of the current bounce.
+    uint32_t m_sampleIndex;
+    uint32_t m_dimension { 0 };
+};
+
+// Seed of the sampler of the pixel at (x, y) in the given animation frame. It does not depend on the resolution,
+// so a pixel gets the same random numbers in full, cropped and tiled renders.
+uint32_t pixelSeed(int x, int y, int frame = 0);
@@ -1,9 +1,32 @@
 #include "scene.h"
+#include "trace_events.h"
 #include <cmath>
 #include <iostream>
 
+glm::mat4 MeshInstance::transformAt(float time) const
+{
+    if (!motionTransform)
+        return transform;
+    return (1.0f - time) * transform + time * *motionTransform;
+}
+
+// Give every mesh that is not instanced yet an instance with an identity transform.
+static void addMissingInstances(Scene& scene)
+{
+    std::vector<bool> instanced(scene.meshes.size(), false);
+    for (const auto& instance : scene.instances) {
+        if (instance.meshIdx < instanced.size())
+            instanced[instance.meshIdx] = true;
+    }
+    for (uint32_t meshIdx = 0; meshIdx < scene.meshes.size(); meshIdx++) {
+        if (!instanced[meshIdx])
+            scene.instances.push_back(MeshInstance { meshIdx });
+    }
+}
+
 Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
 {
+    TraceScope traceScope { "load scene" };
     Scene scene;
     scene.type = type;
     switch (type) {
@@ -88,16 +111,56 @@ Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
     } break;
     };
 
+    addMissingInstances(scene);
+    updateLights(scene);
     return scene;
 }
 
 Scene loadSceneFromFile(const std::filesystem::path& path, const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights)
 {
+    TraceScope traceScope { "load scene" };
     Scene scene;
     scene.lights = std::move(lights);
 
     auto subMeshes = loadMesh(path);
     std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
 
+    addMissingInstances(scene);
+    updateLights(scene);
     return scene;
 }
+
+void updateLights(Scene& scene)
+{
+    TraceScope traceScope { "update lights" };
+    scene.lightSampler = LightSampler(scene.lights);
+
+    LightArrays& lightArrays = scene.lightArrays;
+    lightArrays = {};
+    for (uint32_t lightIdx = 0; lightIdx < scene.lights.size(); lightIdx++) {
+        const auto& light = scene.lights[lightIdx];
+        if (std::holds_alternative<PointLight>(light)) {
+            const PointLight& pointLight = std::get<PointLight>(light);
+            lightArrays.pointPositions.push_back(pointLight.position);
+            lightArrays.pointColors.push_back(pointLight.color);
+            lightArrays.pointIndices.push_back(lightIdx);
+        } else if (std::holds_alternative<SegmentLight>(light)) {
+            const SegmentLight& segmentLight = std::get<SegmentLight>(light);
+            lightArrays.segmentEndpoints0.push_back(segmentLight.endpoint0);
+            lightArrays.segmentEndpoints1.push_back(segmentLight.endpoint1);
+            lightArrays.segmentColors0.push_back(segmentLight.color0);
+            lightArrays.segmentColors1.push_back(segmentLight.color1);
+            lightArrays.segmentIndices.push_back(lightIdx);
+        } else if (std::holds_alternative<ParallelogramLight>(light)) {
+            const ParallelogramLight& parallelogramLight = std::get<ParallelogramLight>(light);
+            lightArrays.parallelogramOrigins.push_back(parallelogramLight.v0);
+            lightArrays.parallelogramEdges01.push_back(parallelogramLight.edge01);
+            lightArrays.parallelogramEdges02.push_back(parallelogramLight.edge02);
+            lightArrays.parallelogramColors0.push_back(parallelogramLight.color0);
+            lightArrays.parallelogramColors1.push_back(parallelogramLight.color1);
+            lightArrays.parallelogramColors2.push_back(parallelogramLight.color2);
+            lightArrays.parallelogramColors3.push_back(parallelogramLight.color3);
+            lightArrays.parallelogramIndices.push_back(lightIdx);
+        }
+    }
+}
@@ -2,6 +2,7 @@
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
 #include <filesystem>
@@ -11,6 +12,7 @@ DISABLE_WARNINGS_POP()
 #include <variant>
 #include <vector>
 #include "common.h"
+#include "light_sampler.h"
 
 enum SceneType {
     SingleTriangle,
@@ -25,11 +27,50 @@ enum SceneType {
     Custom,
 };
 
+// The lights of a scene partitioned by type into contiguous arrays, so that lighting can loop over each
+// type without dispatching on (and copying out of) the std::variant. Each type is stored as a structure of arrays,
+// with one array per member of its light struct. The *Indices arrays hold the index of each light in Scene::lights.
+struct LightArrays {
+    std::vector<glm::vec3> pointPositions;
+    std::vector<glm::vec3> pointColors;
+    std::vector<uint32_t> pointIndices;
+
+    std::vector<glm::vec3> segmentEndpoints0, segmentEndpoints1;
+    std::vector<glm::vec3> segmentColors0, segmentColors1;
+    std::vector<uint32_t> segmentIndices;
+
+    std::vector<glm::vec3> parallelogramOrigins; // ParallelogramLight::v0
+    std::vector<glm::vec3> parallelogramEdges01, parallelogramEdges02;
+    std::vector<glm::vec3> parallelogramColors0, parallelogramColors1, parallelogramColors2, parallelogramColors3;
+    std::vector<uint32_t> parallelogramIndices;
+};
+
+// A placement of one of the meshes of the scene. All instances of a mesh share its vertices and triangles
+// (and its bottom-level BVH), so repeated objects only cost a transform each.
+struct MeshInstance {
+    uint32_t meshIdx = 0;
+    glm::mat4 transform { 1.0f }; // Object to world.
+    // Object to world at the end of the shutter interval, for instances that move while the shutter is open.
+    // In between, the matrices are interpolated linearly (see transformAt), so every point of the instance moves
+    // along a straight line.
+    std::optional<glm::mat4> motionTransform;
+
+    // Object to world at the given time in the shutter interval, in [0, 1].
+    [[nodiscard]] glm::mat4 transformAt(float time) const;
+};
+
 struct Scene {
     SceneType type;
+    // Meshes are in object space; what is rendered are the instances. The loaders create one instance
+    // with an identity transform per mesh.
     std::vector<Mesh> meshes;
+    std::vector<MeshInstance> instances;
     std::vector<Sphere> spheres;
     std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>> lights;
+
+    // Importance sampler over `lights` and the lights partitioned by type; see updateLights().
+    LightSampler lightSampler;
+    LightArrays lightArrays;
 };
 
 // Load a prebuilt scene.
@@ -37,3 +78,6 @@ Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir);
 
 // Load a scene from a file.
 Scene loadSceneFromFile(const std::filesystem::path& path, const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights);
+
+// Rebuild the data that is derived from scene.lights. Call this after adding, removing or editing lights.
+void updateLights(Scene& scene);
@@ -9,6 +9,11 @@ DISABLE_WARNINGS_PUSH()
 #include <stb/stb_image_write.h>
 DISABLE_WARNINGS_POP()
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
 #include <framework/opengl_includes.h>
 #include <string>
 #include <iostream>
@@ -42,17 +47,143 @@ void Screen::setPixel(int x, int y, const glm::vec3& color)
     m_textureData[i] = glm::vec4(color, 1.0f);
 }
 
-void Screen::writeBitmapToFile(const std::filesystem::path& filePath)
+void Screen::writeImageToFile(const std::filesystem::path& filePath) const
+{
+    std::string extension = filePath.extension().string();
+    std::transform(std::begin(extension), std::end(extension), std::begin(extension), ::tolower);
+    if (extension == ".png")
+        writePng16ToFile(filePath);
+    else if (extension == ".pfm")
+        writePfmToFile(filePath);
+    else if (extension == ".hdr")
+        writeHdrToFile(filePath);
+    else
+        writeBitmapToFile(filePath);
+}
+
+void Screen::writeBitmapToFile(const std::filesystem::path& filePath) const
 {
     std::vector<glm::u8vec4> textureData8Bits(m_textureData.size());
-    std::transform(std::begin(m_textureData), std::end(m_textureData), std::begin(textureData8Bits),
-        [](const glm::vec3& color) {
-            const glm::vec3 clampedColor = glm::clamp(color, 0.0f, 1.0f);
-            return glm::u8vec4(glm::vec4(clampedColor, 1.0f) * 255.0f);
-        });
+    const int numPixels = int(m_textureData.size());
+#ifdef NDEBUG
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < numPixels; i++) {
+        const glm::vec3 clampedColor = glm::clamp(m_textureData[size_t(i)], 0.0f, 1.0f);
+        textureData8Bits[size_t(i)] = glm::u8vec4(glm::vec4(clampedColor, 1.0f) * 255.0f);
+    }
+
+    std::string filePathString = filePath.string();
+    if (!stbi_write_bmp(filePathString.c_str(), m_resolution.x, m_resolution.y, 4, textureData8Bits.data()))
+        std::cerr << "Failed to write " << filePath << std::endl;
+}
 
+// CRC-32 as used by PNG chunks (https://www.w3.org/TR/png/#D-CRCAppendix).
+static uint32_t crc32(uint32_t crc, const unsigned char* pData, size_t size)
+{
+    static const auto table = [] {
+        std::array<uint32_t, 256> entries {};
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+        return entries;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ pData[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void writeBigEndian32(std::ostream& stream, uint32_t value)
+{
+    const std::array<char, 4> bytes { char(value >> 24), char(value >> 16), char(value >> 8), char(value) };
+    stream.write(bytes.data(), bytes.size());
+}
+
+static void writePngChunk(std::ostream& stream, const char* pType, const unsigned char* pData, size_t size)
+{
+    writeBigEndian32(stream, uint32_t(size));
+    stream.write(pType, 4);
+    stream.write(reinterpret_cast<const char*>(pData), std::streamsize(size));
+    const uint32_t crc = crc32(crc32(0, reinterpret_cast<const unsigned char*>(pType), 4), pData, size);
+    writeBigEndian32(stream, crc);
+}
+
+// stb_image_write only writes 8-bit PNGs, so the chunks are written here and only the compression is done by stb.
+void Screen::writePng16ToFile(const std::filesystem::path& filePath) const
+{
+    // Every scanline starts with its filter type (0 = none) followed by big endian 16-bit RGB values.
+    const size_t rowSize = 1 + size_t(m_resolution.x) * 6;
+    std::vector<unsigned char> scanlines(rowSize * size_t(m_resolution.y));
+#ifdef NDEBUG
+#pragma omp parallel for schedule(static)
+#endif
+    for (int y = 0; y < m_resolution.y; y++) {
+        unsigned char* pRow = &scanlines[size_t(y) * rowSize];
+        *pRow++ = 0;
+        for (int x = 0; x < m_resolution.x; x++) {
+            const glm::vec3 clampedColor = glm::clamp(m_textureData[size_t(y * m_resolution.x + x)], 0.0f, 1.0f);
+            for (int c = 0; c < 3; c++) {
+                const auto value = uint16_t(clampedColor[c] * 65535.0f + 0.5f);
+                *pRow++ = static_cast<unsigned char>(value >> 8);
+                *pRow++ = static_cast<unsigned char>(value & 0xff);
+            }
+        }
+    }
+
+    int compressedSize = 0;
+    unsigned char* pCompressed = stbi_zlib_compress(scanlines.data(), int(scanlines.size()), &compressedSize, stbi_write_png_compression_level);
+    if (!pCompressed) {
+        std::cerr << "Failed to compress " << filePath << std::endl;
+        return;
+    }
+
+    std::ofstream file { filePath, std::ios::binary };
+    const std::array<unsigned char, 8> signature { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    file.write(reinterpret_cast<const char*>(signature.data()), signature.size());
+    const std::array<unsigned char, 13> header {
+        static_cast<unsigned char>(m_resolution.x >> 24), static_cast<unsigned char>(m_resolution.x >> 16), static_cast<unsigned char>(m_resolution.x >> 8), static_cast<unsigned char>(m_resolution.x),
+        static_cast<unsigned char>(m_resolution.y >> 24), static_cast<unsigned char>(m_resolution.y >> 16), static_cast<unsigned char>(m_resolution.y >> 8), static_cast<unsigned char>(m_resolution.y),
+        16, // Bit depth.
+        2, // Color type: RGB.
+        0, 0, 0 // Compression, filter and interlace method.
+    };
+    writePngChunk(file, "IHDR", header.data(), header.size());
+    writePngChunk(file, "IDAT", pCompressed, size_t(compressedSize));
+    writePngChunk(file, "IEND", nullptr, 0);
+    STBIW_FREE(pCompressed);
+
+    if (!file)
+        std::cerr << "Failed to write " << filePath << std::endl;
+}
+
+// The rows are streamed straight from the frame buffer, which already stores 32-bit float RGB triplets.
+void Screen::writePfmToFile(const std::filesystem::path& filePath) const
+{
+    std::ofstream file { filePath, std::ios::binary };
+    // A negative scale marks the data as little endian.
+    const bool littleEndian = std::endian::native == std::endian::little;
+    file << "PF\n"
+         << m_resolution.x << " " << m_resolution.y << "\n"
+         << (littleEndian ? "-1.0" : "1.0") << "\n";
+    // PFM stores the rows from bottom to top; m_textureData stores them from top to bottom.
+    const auto rowSize = std::streamsize(size_t(m_resolution.x) * sizeof(glm::vec3));
+    for (int y = m_resolution.y - 1; y >= 0; y--)
+        file.write(reinterpret_cast<const char*>(&m_textureData[size_t(y * m_resolution.x)]), rowSize);
+
+    if (!file)
+        std::cerr << "Failed to write " << filePath << std::endl;
+}
+
+void Screen::writeHdrToFile(const std::filesystem::path& filePath) const
+{
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float));
     std::string filePathString = filePath.string();
-    stbi_write_bmp(filePathString.c_str(), m_resolution.x, m_resolution.y, 4, textureData8Bits.data());
+    if (!stbi_write_hdr(filePathString.c_str(), m_resolution.x, m_resolution.y, 3, &m_textureData[0].x))
+        std::cerr << "Failed to write " << filePath << std::endl;
 }
 
 void Screen::draw()
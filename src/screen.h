@@ -14,7 +14,14 @@ public:
     void clear(const glm::vec3& color);
     void setPixel(int x, int y, const glm::vec3& color);
 
-    void writeBitmapToFile(const std::filesystem::path& filePath);
+    // Write the image in the format given by the file extension: *.png (16 bits per channel), *.pfm (32-bit float),
+    // *.hdr (Radiance RGBE) or *.bmp (8 bits per channel, the default for any other extension).
+    void writeImageToFile(const std::filesystem::path& filePath) const;
+
+    void writeBitmapToFile(const std::filesystem::path& filePath) const;
+    void writePng16ToFile(const std::filesystem::path& filePath) const;
+    void writePfmToFile(const std::filesystem::path& filePath) const;
+    void writeHdrToFile(const std::filesystem::path& filePath) const;
     void draw();
 
     [[nodiscard]] glm::ivec2 resolution() const;
@@ -10,10 +10,18 @@ const glm::vec3 computeShading(const glm::vec3& lightPosition, const glm::vec3&
 }
 
 
+// Offset applied to the origin of reflection rays to prevent self intersection.
+static constexpr float reflectionRayEpsilon = 1e-4f;
+
 const Ray computeReflectionRay (Ray ray, HitInfo hitInfo)
 {
     // Do NOT use glm::reflect!! write your own code.
+    const glm::vec3 hitPoint = ray.origin + ray.t * ray.direction;
+    const glm::vec3 n = glm::normalize(hitInfo.normal);
+    const glm::vec3 direction = glm::normalize(ray.direction - 2.0f * glm::dot(ray.direction, n) * n);
     Ray reflectionRay {};
-    // TODO: implement the reflection ray computation.
+    reflectionRay.origin = hitPoint + reflectionRayEpsilon * direction;
+    reflectionRay.direction = direction;
+    reflectionRay.time = ray.time;
     return reflectionRay;
 }
\ No newline at end of file
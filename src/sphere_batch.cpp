@@ -0,0 +1,109 @@
+#include "sphere_batch.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+SphereBatch makeSphereBatch(std::span<const Sphere> spheres, std::span<const uint32_t> sphereIndices)
+{
+    SphereBatch batch;
+    const size_t paddedSize = sphereIndices.size() + sphereBatchWidth - 1;
+    batch.centerX.resize(paddedSize, 0.0f);
+    batch.centerY.resize(paddedSize, 0.0f);
+    batch.centerZ.resize(paddedSize, 0.0f);
+    batch.radius.resize(paddedSize, 0.0f);
+    batch.materials.reserve(sphereIndices.size());
+    batch.sphereIndices.assign(std::begin(sphereIndices), std::end(sphereIndices));
+    for (size_t i = 0; i < sphereIndices.size(); i++) {
+        const Sphere& sphere = spheres[sphereIndices[i]];
+        batch.centerX[i] = sphere.center.x;
+        batch.centerY[i] = sphere.center.y;
+        batch.centerZ[i] = sphere.center.z;
+        batch.radius[i] = sphere.radius;
+        batch.materials.push_back(sphere.material);
+    }
+    return batch;
+}
+
+// Distance along the ray to the sphere, or infinity if the ray misses it or the sphere lies behind the origin.
+// a is the squared length of the ray direction. This is the lane of intersectRayWithSpheres; it is free of branches,
+// and inline so that GCC also inlines it into the loop over the lanes (and vectorizes that) at -O2.
+static inline float sphereDistance(const Ray& ray, float a, float invA, float centerX, float centerY, float centerZ, float radius)
+{
+    constexpr float noHit = std::numeric_limits<float>::infinity();
+    const float ox = ray.origin.x - centerX;
+    const float oy = ray.origin.y - centerY;
+    const float oz = ray.origin.z - centerZ;
+    const float b = ox * ray.direction.x + oy * ray.direction.y + oz * ray.direction.z;
+    const float c = ox * ox + oy * oy + oz * oz - radius * radius;
+    // b^2 - a c cancels catastrophically for small and distant spheres; compute it from the vector between
+    // the center and the closest point on the line instead ("Precision Improvements for Ray/Sphere
+    // Intersection", Ray Tracing Gems, chapter 7).
+    const float lx = ox - b * invA * ray.direction.x;
+    const float ly = oy - b * invA * ray.direction.y;
+    const float lz = oz - b * invA * ray.direction.z;
+    const float discriminant = a * (radius * radius - (lx * lx + ly * ly + lz * lz));
+    const float q = -(b + std::copysign(std::sqrt(std::max(discriminant, 0.0f)), b));
+    const float t0 = c / q, t1 = q * invA;
+    const float tNear = std::min(t0, t1);
+    const float tFar = std::max(t0, t1);
+    // The far root is hit when the origin is inside the sphere.
+    const float t = tNear > 0.0f ? tNear : tFar;
+    const bool valid = (discriminant >= 0.0f) & (t > 0.0f);
+    return valid ? t : noHit;
+}
+
+int intersectRayWithSpheres(const SphereBatch& batch, uint32_t begin, uint32_t end, Ray& ray)
+{
+    constexpr float noHit = std::numeric_limits<float>::infinity();
+    const float a = glm::dot(ray.direction, ray.direction);
+    const float invA = 1.0f / a;
+
+    int closest = -1;
+    for (uint32_t first = begin; first < end; first += sphereBatchWidth) {
+        // The lanes compute both roots and combine their conditions with bitwise operations and selects, without
+        // branches, so that GCC and Clang vectorize this loop at -O3 (check with -fopt-info-vec). That also needs
+        // a sqrt that does not set errno, which CMakeLists.txt enables for this file with -fno-math-errno.
+        std::array<float, sphereBatchWidth> distances;
+        for (uint32_t lane = 0; lane < sphereBatchWidth; lane++) {
+            const uint32_t i = first + lane;
+            const float t = sphereDistance(ray, a, invA, batch.centerX[i], batch.centerY[i], batch.centerZ[i], batch.radius[i]);
+            distances[lane] = i < end ? t : noHit;
+        }
+
+        // Most batches are missed, so only the closest distance is compared against the ray before looking for
+        // the lane that it belongs to (the first one, if several spheres are hit at the same distance).
+        float closestDistance = distances[0];
+        for (uint32_t lane = 1; lane < sphereBatchWidth; lane++)
+            closestDistance = std::min(closestDistance, distances[lane]);
+        if (closestDistance < ray.t) {
+            ray.t = closestDistance;
+            const auto lane = std::find(std::begin(distances), std::end(distances), closestDistance) - std::begin(distances);
+            closest = int(first) + int(lane);
+        }
+    }
+    return closest;
+}
+
+void computeSphereHitInfo(const SphereBatch& batch, uint32_t position, const Ray& ray, HitInfo& hitInfo)
+{
+    const glm::vec3 center { batch.centerX[position], batch.centerY[position], batch.centerZ[position] };
+    hitInfo.normal = glm::normalize(ray.origin + ray.t * ray.direction - center);
+    hitInfo.material = batch.materials[position];
+    hitInfo.primitive = { PrimitiveType::Sphere, 0, batch.sphereIndices[position] };
+}
+
+bool intersectRayWithSphere(const Sphere& sphere, Ray& ray)
+{
+    const float a = glm::dot(ray.direction, ray.direction);
+    const float t = sphereDistance(ray, a, 1.0f / a, sphere.center.x, sphere.center.y, sphere.center.z, sphere.radius);
+    if (!(t < ray.t))
+        return false;
+    ray.t = t;
+    return true;
+}
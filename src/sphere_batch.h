@@ -0,0 +1,35 @@
+#pragma once
+#include "common.h"
+#include <cstdint>
+#include <framework/ray.h>
+#include <span>
+#include <vector>
+
+// Number of spheres that intersectRayWithSpheres tests per iteration.
+inline constexpr uint32_t sphereBatchWidth = 8;
+
+// Spheres stored as a structure of arrays: the centers and radii that every intersection test reads are packed
+// together, while the materials (which are only needed for the sphere that is hit) are kept separately.
+// The coordinate arrays are padded by sphereBatchWidth - 1 entries so that a batch may start at any sphere.
+struct SphereBatch {
+    std::vector<float> centerX, centerY, centerZ, radius;
+    std::vector<Material> materials;
+    std::vector<uint32_t> sphereIndices; // Index of each sphere in the array that the batch was made from.
+
+    [[nodiscard]] uint32_t size() const { return uint32_t(sphereIndices.size()); }
+};
+
+// Copy the given spheres into a batch, in the given order.
+SphereBatch makeSphereBatch(std::span<const Sphere> spheres, std::span<const uint32_t> sphereIndices);
+
+// Intersect the ray with the spheres [begin, end) of the batch, sphereBatchWidth at a time. Returns the position in
+// the batch of the closest sphere that is hit in front of the origin and closer than ray.t (updating ray.t), or -1.
+int intersectRayWithSpheres(const SphereBatch& batch, uint32_t begin, uint32_t end, Ray& ray);
+
+// Intersect the ray with a single sphere, computing exactly what intersectRayWithSpheres computes for it, so that
+// both agree on every ray. Returns true if the sphere is hit in front of the origin and closer than ray.t (updating
+// ray.t). Unlike intersectRayWithShape, this does not fill in a HitInfo.
+bool intersectRayWithSphere(const Sphere& sphere, Ray& ray);
+
+// Fill in the normal and material of a hit found by intersectRayWithSpheres.
+void computeSphereHitInfo(const SphereBatch& batch, uint32_t position, const Ray& ray, HitInfo& hitInfo);
@@ -0,0 +1,153 @@
+#include "trace_events.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/core.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    std::string name;
+    TraceClock::time_point begin, end;
+};
+
+// The events of one thread. Only the owning thread appends to it; the lock is for writeTraceEvents, which may run
+// while (thread pool) threads that recorded events are still alive.
+struct ThreadTrace {
+    uint32_t id;
+    std::string name;
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+};
+
+// Owns the events of every thread that recorded any, including threads that have exited since.
+struct TraceRegistry {
+    std::atomic<bool> enabled { false };
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadTrace>> threads;
+};
+
+TraceRegistry& traceRegistry()
+{
+    static TraceRegistry registry;
+    return registry;
+}
+
+ThreadTrace& threadTrace()
+{
+    static thread_local ThreadTrace* pThreadTrace = [] {
+        TraceRegistry& registry = traceRegistry();
+        std::scoped_lock lock { registry.mutex };
+        auto pTrace = std::make_unique<ThreadTrace>();
+        pTrace->id = uint32_t(registry.threads.size());
+        pTrace->name = fmt::format("thread {}", pTrace->id);
+        registry.threads.push_back(std::move(pTrace));
+        return registry.threads.back().get();
+    }();
+    return *pThreadTrace;
+}
+
+std::string escapeJson(const std::string& str)
+{
+    std::string out;
+    out.reserve(str.size());
+    for (const char c : str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += fmt::format("\\u{:04x}", int(c));
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+double microsecondsSince(TraceClock::time_point epoch, TraceClock::time_point time)
+{
+    return std::chrono::duration<double, std::micro>(time - epoch).count();
+}
+
+}
+
+void startTraceRecording()
+{
+    traceRegistry().enabled.store(true, std::memory_order_relaxed);
+}
+
+bool traceRecordingEnabled()
+{
+    return traceRegistry().enabled.load(std::memory_order_relaxed);
+}
+
+void setTraceThreadName(std::string name)
+{
+    ThreadTrace& trace = threadTrace();
+    std::scoped_lock lock { trace.mutex };
+    trace.name = std::move(name);
+}
+
+void addTraceEvent(std::string name, TraceClock::time_point begin, TraceClock::time_point end)
+{
+    if (!traceRecordingEnabled())
+        return;
+    ThreadTrace& trace = threadTrace();
+    std::scoped_lock lock { trace.mutex };
+    trace.events.push_back(TraceEvent { std::move(name), begin, end });
+}
+
+bool writeTraceEvents(const std::filesystem::path& filePath)
+{
+    TraceRegistry& registry = traceRegistry();
+    std::ofstream file { filePath };
+    if (!file)
+        return false;
+
+    std::scoped_lock registryLock { registry.mutex };
+    // The timeline starts at the first event.
+    TraceClock::time_point epoch = TraceClock::time_point::max();
+    for (const auto& pThread : registry.threads) {
+        std::scoped_lock lock { pThread->mutex };
+        for (const TraceEvent& event : pThread->events)
+            epoch = std::min(epoch, event.begin);
+    }
+
+    // Complete ("X") events with their start and duration in microseconds, and a name for every thread.
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (const auto& pThread : registry.threads) {
+        std::scoped_lock lock { pThread->mutex };
+        file << (first ? "" : ",\n")
+             << fmt::format(R"({{"name": "thread_name", "ph": "M", "pid": 1, "tid": {}, "args": {{"name": "{}"}}}})", pThread->id, escapeJson(pThread->name));
+        first = false;
+        for (const TraceEvent& event : pThread->events) {
+            file << fmt::format(",\n" R"({{"name": "{}", "ph": "X", "pid": 1, "tid": {}, "ts": {:.3f}, "dur": {:.3f}}})",
+                escapeJson(event.name), pThread->id, microsecondsSince(epoch, event.begin), microsecondsSince(event.begin, event.end));
+        }
+    }
+    file << "\n]}\n";
+    return bool(file);
+}
+
+TraceScope::TraceScope(std::string name)
+    : m_enabled(traceRecordingEnabled())
+{
+    if (m_enabled) {
+        m_name = std::move(name);
+        m_begin = TraceClock::now();
+    }
+}
+
+TraceScope::~TraceScope()
+{
+    if (m_enabled)
+        addTraceEvent(std::move(m_name), m_begin, TraceClock::now());
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+// Timeline of the phases of a run (reading the config, loading the scene, building the BVH, rendering every camera
+// and row, writing the images), per thread, for finding out where the time goes and where threads stall. Recording
+// is off until startTraceRecording is called (see Config::traceFile); until then a TraceScope only checks a flag.
+// The timeline is written as Chrome trace JSON, which chrome://tracing and ui.perfetto.dev can open.
+
+using TraceClock = std::chrono::steady_clock;
+
+void startTraceRecording();
+[[nodiscard]] bool traceRecordingEnabled();
+
+// Name the calling thread in the timeline; threads that are not named show up as "thread <n>".
+void setTraceThreadName(std::string name);
+
+// Record an event of the calling thread that has already ended, e.g. one from before recording was started.
+void addTraceEvent(std::string name, TraceClock::time_point begin, TraceClock::time_point end);
+
+// Write the events that all threads recorded so far. Returns false if the file could not be written.
+bool writeTraceEvents(const std::filesystem::path& filePath);
+
+// Records an event from construction to destruction on the calling thread.
+class TraceScope {
+public:
+    explicit TraceScope(std::string name);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    std::string m_name;
+    TraceClock::time_point m_begin;
+    bool m_enabled;
+};
@@ -0,0 +1,218 @@
+#include "wavefront.h"
+#include "light.h"
+#include "ray_statistics.h"
+#include "ray_stream.h"
+#include "render.h"
+#include "sampler.h"
+#include "screen.h"
+#include "trace_events.h"
+#include <algorithm>
+#include <framework/trackball.h>
+#include <numeric>
+#include <vector>
+#ifdef NDEBUG
+#include <omp.h>
+#endif
+
+// Rays of one bounce, stored as a structure of arrays.
+struct RayQueue {
+    std::vector<Ray> rays;
+    std::vector<glm::vec3> throughputs;
+    std::vector<uint32_t> pixels;
+    std::vector<int> depths;
+};
+
+// Shadow rays; contribution is added to the pixel if the ray is not occluded.
+struct ShadowRayQueue {
+    std::vector<Ray> rays;
+    std::vector<glm::vec3> contributions;
+    std::vector<uint32_t> pixels;
+};
+
+template <typename T>
+static void append(std::vector<T>& dst, const std::vector<T>& src)
+{
+    dst.insert(std::end(dst), std::begin(src), std::end(src));
+}
+
+// Number of contiguous chunks that the stages producing new rays are split into (one per thread).
+// The chunks are concatenated in order, so the queues do not depend on the number of threads or their timing.
+static size_t numChunks()
+{
+#ifdef NDEBUG
+    return size_t(omp_get_max_threads());
+#else
+    return 1;
+#endif
+}
+
+// Sort key that groups hits on the same material: every mesh has a single material, and every sphere its own.
+static uint64_t materialKey(const PrimitiveRef& primitive)
+{
+    if (primitive.type == PrimitiveType::Sphere)
+        return (uint64_t(1) << 32) | primitive.primitiveIdx;
+    return primitive.meshIdx;
+}
+
+void renderRayTracingWavefront(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, int frame, const std::optional<RenderRegion>& region)
+{
+    const glm::ivec2 windowResolution = screen.resolution();
+    const RenderRegion imageRegion = region.value_or(RenderRegion { windowResolution });
+    const size_t numPixels = size_t(windowResolution.x) * size_t(windowResolution.y);
+
+    // Stage 1: generate the camera rays, and a sampler per pixel that persists across the bounces.
+    std::vector<glm::vec3> radiance(numPixels, glm::vec3(0.0f));
+    std::vector<Sampler> samplers;
+    samplers.reserve(numPixels);
+    RayQueue queue;
+    queue.rays.resize(numPixels);
+    queue.throughputs.assign(numPixels, glm::vec3(1.0f));
+    queue.pixels.resize(numPixels);
+    queue.depths.assign(numPixels, 0);
+    for (int y = 0; y < windowResolution.y; y++) {
+        for (int x = 0; x != windowResolution.x; x++) {
+            const uint32_t pixel = uint32_t(y * windowResolution.x + x);
+            const glm::ivec2 imagePixel = imageRegion.offset + glm::ivec2(x, y);
+            // NOTE: (-1, -1) at the bottom left of the image, (+1, +1) at the top right of the image.
+            const glm::vec2 normalizedPixelPos {
+                float(imagePixel.x) / float(imageRegion.imageResolution.x) * 2.0f - 1.0f,
+                float(imagePixel.y) / float(imageRegion.imageResolution.y) * 2.0f - 1.0f
+            };
+            queue.rays[pixel] = camera.generateRay(normalizedPixelPos);
+            queue.pixels[pixel] = pixel;
+            samplers.emplace_back(pixelSeed(imagePixel.x, imagePixel.y, frame));
+            if (features.extra.enableMotionBlur)
+                queue.rays[pixel].time = samplers.back().next1D();
+        }
+    }
+
+    std::vector<HitInfo> hits;
+    std::vector<char> hitMask;
+    std::vector<uint32_t> order, traversalOrder;
+    const AxisAlignedBox sceneBounds = computeSceneBounds(scene);
+    const size_t chunks = numChunks();
+    for (int bounce = 0; !queue.rays.empty(); bounce++) {
+        const int numRays = int(queue.rays.size());
+        TraceScope bounceScope { "wavefront bounce" };
+
+        // Stage 2: intersect all rays of this bounce. Camera rays are coherent already (scanline order), but the
+        // reflection rays of later bounces are optionally binned by origin and direction first.
+        hits.assign(size_t(numRays), HitInfo {});
+        hitMask.assign(size_t(numRays), 0);
+        if (features.enableRaySorting && bounce > 0) {
+            sortRaysByCoherence(queue.rays, sceneBounds, traversalOrder);
+        } else {
+            traversalOrder.resize(size_t(numRays));
+            std::iota(std::begin(traversalOrder), std::end(traversalOrder), 0u);
+        }
+        countRays(bounce == 0 ? RayType::Camera : RayType::Reflection, uint64_t(numRays));
+        {
+            TraceScope traceScope { "intersect rays" };
+            intersectRayStream(bvh, queue.rays, traversalOrder, hits, hitMask, features, bounce == 0 ? RayType::Camera : RayType::Reflection);
+        }
+
+        // Stage 3: drop the rays that missed and sort the hits by material so that shading works on coherent batches.
+        order.clear();
+        for (uint32_t i = 0; i < uint32_t(numRays); i++) {
+            if (hitMask[i])
+                order.push_back(i);
+        }
+        std::sort(std::begin(order), std::end(order), [&](uint32_t lhs, uint32_t rhs) {
+            const uint64_t lhsKey = materialKey(hits[lhs].primitive), rhsKey = materialKey(hits[rhs].primitive);
+            return lhsKey != rhsKey ? lhsKey < rhsKey : lhs < rhs;
+        });
+
+        // Stage 4: shade the hits. Contributions that need no shadow ray are added directly; the others and the
+        // reflection rays are appended to the per-chunk queues of the next stages. Every pixel has at most one ray
+        // per bounce, so the radiance of different hits can be updated in parallel.
+        std::vector<ShadowRayQueue> shadowChunks(chunks);
+        std::vector<RayQueue> nextChunks(chunks);
+#ifdef NDEBUG
+#pragma omp parallel for schedule(static)
+#endif
+        for (int chunk = 0; chunk < int(chunks); chunk++) {
+            TraceScope traceScope { "shade hits" };
+            ShadowRayQueue& shadowQueue = shadowChunks[size_t(chunk)];
+            RayQueue& nextQueue = nextChunks[size_t(chunk)];
+            std::vector<LightSample> lightSamples;
+            const size_t begin = order.size() * size_t(chunk) / chunks;
+            const size_t end = order.size() * size_t(chunk + 1) / chunks;
+            for (size_t j = begin; j < end; j++) {
+                const uint32_t i = order[j];
+                const Ray& ray = queue.rays[i];
+                const HitInfo& hitInfo = hits[i];
+                const uint32_t pixel = queue.pixels[i];
+                const glm::vec3& throughput = queue.throughputs[i];
+                Sampler& sampler = samplers[pixel];
+                sampler.startBounce(queue.depths[i]);
+
+                if (features.enableShading) {
+                    lightSamples.clear();
+                    generateLightSamples(scene, features, sampler, lightSamples);
+                    for (const LightSample& lightSample : lightSamples) {
+                        Ray shadowRay;
+                        if (lightSample.testVisibility && !computeShadowRay(lightSample.position, ray, hitInfo, shadowRay))
+                            continue;
+                        const glm::vec3 contribution = throughput * lightSample.weight * computeShading(lightSample.position, lightSample.color, features, ray, hitInfo);
+                        if (lightSample.testVisibility) {
+                            shadowQueue.rays.push_back(shadowRay);
+                            shadowQueue.contributions.push_back(contribution);
+                            shadowQueue.pixels.push_back(pixel);
+                        } else {
+                            radiance[pixel] += contribution;
+                        }
+                    }
+                } else {
+                    radiance[pixel] += throughput * hitInfo.material.kd;
+                }
+
+                glm::vec3 nextThroughput = throughput;
+                if (continuePath(features, hitInfo, queue.depths[i], sampler, nextThroughput)) {
+                    nextQueue.rays.push_back(computeReflectionRay(ray, hitInfo));
+                    nextQueue.throughputs.push_back(nextThroughput);
+                    nextQueue.pixels.push_back(pixel);
+                    nextQueue.depths.push_back(queue.depths[i] + 1);
+                }
+            }
+        }
+
+        // Stage 5: trace all shadow rays of this bounce and add the contributions of the unoccluded ones.
+        ShadowRayQueue shadowQueue;
+        for (const ShadowRayQueue& shadowChunk : shadowChunks) {
+            append(shadowQueue.rays, shadowChunk.rays);
+            append(shadowQueue.contributions, shadowChunk.contributions);
+            append(shadowQueue.pixels, shadowChunk.pixels);
+        }
+        const size_t numShadowRays = shadowQueue.rays.size();
+        std::vector<char> occluded(numShadowRays, 0);
+        if (features.enableRaySorting) {
+            sortRaysByCoherence(shadowQueue.rays, sceneBounds, traversalOrder);
+        } else {
+            traversalOrder.resize(numShadowRays);
+            std::iota(std::begin(traversalOrder), std::end(traversalOrder), 0u);
+        }
+        countRays(RayType::Shadow, numShadowRays);
+        {
+            TraceScope traceScope { "trace shadow rays" };
+            occludedRayStream(bvh, shadowQueue.rays, traversalOrder, occluded, features);
+        }
+        for (size_t i = 0; i < numShadowRays; i++) {
+            if (!occluded[i])
+                radiance[shadowQueue.pixels[i]] += shadowQueue.contributions[i];
+        }
+
+        // Stage 6: the reflection rays form the queue of the next bounce.
+        queue = {};
+        for (const RayQueue& nextChunk : nextChunks) {
+            append(queue.rays, nextChunk.rays);
+            append(queue.throughputs, nextChunk.throughputs);
+            append(queue.pixels, nextChunk.pixels);
+            append(queue.depths, nextChunk.depths);
+        }
+    }
+
+    for (int y = 0; y < windowResolution.y; y++) {
+        for (int x = 0; x != windowResolution.x; x++)
+            screen.setPixel(x, y, radiance[size_t(y * windowResolution.x + x)]);
+    }
+}
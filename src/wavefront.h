@@ -0,0 +1,23 @@
+#pragma once
+#include "render.h"
+#include <framework/ray.h>
+#include <optional>
+
+// Forward declarations.
+struct Scene;
+class Screen;
+class Trackball;
+class BvhInterface;
+struct Features;
+
+// Breadth-first (wavefront) alternative to the per-pixel loop of renderRayTracing.
+//
+// Instead of following each pixel depth first through getFinalColor, every stage of the ray tracer is run for
+// all pixels before moving on to the next one: all camera rays are generated, then intersected in bulk, the
+// hits are sorted by material and shaded in batches, and the shadow and reflection rays that shading produces
+// are collected in queues and traced as separate stages. Each stage is a tight loop over one queue.
+//
+// Produces the same image as renderRayTracing up to floating-point summation order: every pixel draws the same
+// random numbers from its sampler, but its radiance is accumulated per bounce (with the unoccluded shadow rays added
+// in a stage of their own) instead of recursively, so the sums can differ in the last bits.
+void renderRayTracingWavefront(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, int frame = 0, const std::optional<RenderRegion>& region = {});